@@ -4014,7 +4014,17 @@ static void e1000_tx_queue(struct e1000_adapter *adapter,
 	wmb();
 
 	tx_ring->next_to_use = i;
-	writel(i, adapter->hw.hw_addr + tx_ring->tail);
+}
+
+/*
+ * Let the hardware fetch all descriptors queued so far; the tail write is
+ * deferred while the stack tells us more packets follow (skb->xmit_more).
+ */
+static void e1000_tx_ring_doorbell(struct e1000_adapter *adapter)
+{
+	struct e1000_ring *tx_ring = adapter->tx_ring;
+
+	writel(tx_ring->next_to_use, adapter->hw.hw_addr + tx_ring->tail);
 	/*
 	 * we need this if more than one processor can write to our tail
 	 * at a time, it synchronizes IO on IA64/Altix systems
@@ -4022,6 +4032,14 @@ static void e1000_tx_queue(struct e1000_adapter *adapter,
 	mmiowb();
 }
 
+static void e1000_xmit_flush(struct net_device *netdev, u16 queue)
+{
+	struct e1000_adapter *adapter = netdev_priv(netdev);
+
+	if (!test_bit(__E1000_DOWN, &adapter->state))
+		e1000_tx_ring_doorbell(adapter);
+}
+
 #define MINIMUM_DHCP_PACKET_SIZE 282
 static int e1000_transfer_dhcp_info(struct e1000_adapter *adapter,
 				    struct sk_buff *skb)
@@ -4111,6 +4129,7 @@ static netdev_tx_t e1000_xmit_frame(struct sk_buff *skb,
 	int count = 0;
 	int tso;
 	unsigned int f;
+	bool xmit_more = skb->xmit_more;
 
 	if (test_bit(__E1000_DOWN, &adapter->state)) {
 		dev_kfree_skb_any(skb);
@@ -4119,7 +4138,7 @@ static netdev_tx_t e1000_xmit_frame(struct sk_buff *skb,
 
 	if (skb->len <= 0) {
 		dev_kfree_skb_any(skb);
-		return NETDEV_TX_OK;
+		goto out;
 	}
 
 	mss = skb_shinfo(skb)->gso_size;
@@ -4153,7 +4172,7 @@ static netdev_tx_t e1000_xmit_frame(struct sk_buff *skb,
 			if (!__pskb_pull_tail(skb, pull_size)) {
 				e_err("__pskb_pull_tail failed.\n");
 				dev_kfree_skb_any(skb);
-				return NETDEV_TX_OK;
+				goto out;
 			}
 			len = skb->len - skb->data_len;
 		}
@@ -4178,8 +4197,10 @@ static netdev_tx_t e1000_xmit_frame(struct sk_buff *skb,
 	 * need: count + 2 desc gap to keep tail from touching
 	 * head, otherwise try next time
 	 */
-	if (e1000_maybe_stop_tx(netdev, count + 2))
+	if (e1000_maybe_stop_tx(netdev, count + 2)) {
+		e1000_tx_ring_doorbell(adapter);
 		return NETDEV_TX_BUSY;
+	}
 
 	if (adapter->vlgrp && vlan_tx_tag_present(skb)) {
 		tx_flags |= E1000_TX_FLAGS_VLAN;
@@ -4191,7 +4212,7 @@ static netdev_tx_t e1000_xmit_frame(struct sk_buff *skb,
 	tso = e1000_tso(adapter, skb);
 	if (tso < 0) {
 		dev_kfree_skb_any(skb);
-		return NETDEV_TX_OK;
+		goto out;
 	}
 
 	if (tso)
@@ -4220,6 +4241,10 @@ static netdev_tx_t e1000_xmit_frame(struct sk_buff *skb,
 		tx_ring->next_to_use = first;
 	}
 
+out:
+	if (!xmit_more || netif_queue_stopped(netdev))
+		e1000_tx_ring_doorbell(adapter);
+
 	return NETDEV_TX_OK;
 }
 
@@ -4915,6 +4940,7 @@ static const struct net_device_ops e1000e_netdev_ops = {
 	.ndo_open		= e1000_open,
 	.ndo_stop		= e1000_close,
 	.ndo_start_xmit		= e1000_xmit_frame,
+	.ndo_xmit_flush		= e1000_xmit_flush,
 	.ndo_get_stats		= e1000_get_stats,
 	.ndo_set_multicast_list	= e1000_set_multi,
 	.ndo_set_mac_address	= e1000_set_mac,
@@ -5568,7 +5568,23 @@ static void ixgbe_tx_queue(struct ixgbe_adapter *adapter,
 	wmb();
 
 	tx_ring->next_to_use = i;
-	writel(i, adapter->hw.hw_addr + tx_ring->tail);
+}
+
+/*
+ * Let the hardware fetch all descriptors queued so far; the tail write is
+ * deferred while the stack tells us more packets follow (skb->xmit_more).
+ */
+static inline void ixgbe_tx_ring_doorbell(struct ixgbe_adapter *adapter,
+					  struct ixgbe_ring *tx_ring)
+{
+	writel(tx_ring->next_to_use, adapter->hw.hw_addr + tx_ring->tail);
+}
+
+static void ixgbe_xmit_flush(struct net_device *netdev, u16 queue)
+{
+	struct ixgbe_adapter *adapter = netdev_priv(netdev);
+
+	ixgbe_tx_ring_doorbell(adapter, adapter->tx_ring[queue]);
 }
 
 static void ixgbe_atr(struct ixgbe_adapter *adapter, struct sk_buff *skb,
@@ -5688,6 +5704,7 @@ static netdev_tx_t ixgbe_xmit_frame(struct sk_buff *skb,
 	int tso;
 	int count = 0;
 	unsigned int f;
+	bool xmit_more = skb->xmit_more;
 
 	if (adapter->vlgrp && vlan_tx_tag_present(skb)) {
 		tx_flags |= vlan_tx_tag_get(skb);
@@ -5737,6 +5754,7 @@ static netdev_tx_t ixgbe_xmit_frame(struct sk_buff *skb,
 
 	if (ixgbe_maybe_stop_tx(netdev, tx_ring, count)) {
 		adapter->tx_busy++;
+		ixgbe_tx_ring_doorbell(adapter, tx_ring);
 		return NETDEV_TX_BUSY;
 	}
 
@@ -5747,7 +5765,7 @@ static netdev_tx_t ixgbe_xmit_frame(struct sk_buff *skb,
 		tso = ixgbe_fso(adapter, tx_ring, skb, tx_flags, &hdr_len);
 		if (tso < 0) {
 			dev_kfree_skb_any(skb);
-			return NETDEV_TX_OK;
+			goto out;
 		}
 		if (tso)
 			tx_flags |= IXGBE_TX_FLAGS_FSO;
@@ -5758,7 +5776,7 @@ static netdev_tx_t ixgbe_xmit_frame(struct sk_buff *skb,
 		tso = ixgbe_tso(adapter, tx_ring, skb, tx_flags, &hdr_len);
 		if (tso < 0) {
 			dev_kfree_skb_any(skb);
-			return NETDEV_TX_OK;
+			goto out;
 		}
 
 		if (tso)
@@ -5794,6 +5812,11 @@ static netdev_tx_t ixgbe_xmit_frame(struct sk_buff *skb,
 		tx_ring->next_to_use = first;
 	}
 
+out:
+	if (!xmit_more ||
+	    __netif_subqueue_stopped(netdev, tx_ring->queue_index))
+		ixgbe_tx_ring_doorbell(adapter, tx_ring);
+
 	return NETDEV_TX_OK;
 }
 
@@ -5931,6 +5954,7 @@ static const struct net_device_ops ixgbe_netdev_ops = {
 	.ndo_open 		= ixgbe_open,
 	.ndo_stop		= ixgbe_close,
 	.ndo_start_xmit		= ixgbe_xmit_frame,
+	.ndo_xmit_flush		= ixgbe_xmit_flush,
 	.ndo_select_queue	= ixgbe_select_queue,
 	.ndo_set_rx_mode        = ixgbe_set_rx_mode,
 	.ndo_set_multicast_list	= ixgbe_set_rx_mode,
@@ -193,6 +193,29 @@ static int macvtap_forward(struct net_device *dev, struct sk_buff *skb)
 static int macvtap_receive(struct sk_buff *skb)
 {
 	skb_push(skb, ETH_HLEN);
+
+	/* virtio_net_hdr has no type for a GRO train of UDP datagrams */
+	if (skb_is_gso(skb) &&
+	    (skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4)) {
+		struct sk_buff *segs, *next;
+		struct net_device *dev = skb->dev;
+
+		segs = skb_gso_segment(skb, NETIF_F_SG | NETIF_F_HW_CSUM);
+		if (IS_ERR(segs) || !segs) {
+			kfree_skb(skb);
+			return NET_RX_DROP;
+		}
+		consume_skb(skb);
+
+		for (; segs; segs = next) {
+			next = segs->next;
+			segs->next = NULL;
+			if (macvtap_forward(dev, segs))
+				kfree_skb(segs);
+		}
+		return 0;
+	}
+
 	return macvtap_forward(skb->dev, skb);
 }
 
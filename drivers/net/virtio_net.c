@@ -565,6 +565,7 @@ static int xmit_skb(struct virtnet_info *vi, struct sk_buff *skb)
 static netdev_tx_t start_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct virtnet_info *vi = netdev_priv(dev);
+	bool xmit_more = skb->xmit_more;
 	int capacity;
 
 again:
@@ -583,9 +584,10 @@ again:
 			netif_start_queue(dev);
 			goto again;
 		}
+		/* Don't leave earlier, batched buffers unannounced */
+		vi->svq->vq_ops->kick(vi->svq);
 		return NETDEV_TX_BUSY;
 	}
-	vi->svq->vq_ops->kick(vi->svq);
 
 	/* Don't wait up for transmitted skbs to be freed. */
 	skb_orphan(skb);
@@ -605,9 +607,20 @@ again:
 		}
 	}
 
+	/* Only notify the host once per batch of packets */
+	if (!xmit_more || netif_queue_stopped(dev))
+		vi->svq->vq_ops->kick(vi->svq);
+
 	return NETDEV_TX_OK;
 }
 
+static void virtnet_xmit_flush(struct net_device *dev, u16 queue)
+{
+	struct virtnet_info *vi = netdev_priv(dev);
+
+	vi->svq->vq_ops->kick(vi->svq);
+}
+
 static int virtnet_set_mac_address(struct net_device *dev, void *p)
 {
 	struct virtnet_info *vi = netdev_priv(dev);
@@ -840,6 +853,7 @@ static const struct net_device_ops virtnet_netdev = {
 	.ndo_open            = virtnet_open,
 	.ndo_stop   	     = virtnet_close,
 	.ndo_start_xmit      = start_xmit,
+	.ndo_xmit_flush      = virtnet_xmit_flush,
 	.ndo_validate_addr   = eth_validate_addr,
 	.ndo_set_mac_address = virtnet_set_mac_address,
 	.ndo_set_rx_mode     = virtnet_set_rx_mode,
@@ -10,11 +10,9 @@
 #include <linux/eventfd.h>
 #include <linux/vhost.h>
 #include <linux/virtio_net.h>
-#include <linux/mmu_context.h>
 #include <linux/miscdevice.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
-#include <linux/workqueue.h>
 #include <linux/rcupdate.h>
 #include <linux/file.h>
 #include <linux/slab.h>
@@ -75,6 +73,48 @@ static int move_iovec_hdr(struct iovec *from, struct iovec *to,
 	return seg;
 }
 
+static u64 busy_clock(void)
+{
+	return cpu_clock(smp_processor_id()) >> 10;
+}
+
+static bool vhost_can_busy_poll(struct vhost_dev *dev, u64 endtime)
+{
+	return likely(!need_resched()) &&
+	       likely(!time_after64(busy_clock(), endtime)) &&
+	       likely(!signal_pending(current)) &&
+	       !vhost_has_work(dev);
+}
+
+/* Get the next TX descriptor.  If the ring is empty and busy polling is
+ * enabled, spin on the avail index for up to busyloop_timeout us first:
+ * a guest that is still transmitting refills the ring without having to
+ * kick us, which saves an exit and a wakeup per batch. */
+static unsigned vhost_net_tx_get_vq_desc(struct vhost_net *net,
+					 struct vhost_virtqueue *vq,
+					 unsigned int *out_num,
+					 unsigned int *in_num)
+{
+	unsigned r = vhost_get_vq_desc(&net->dev, vq, vq->iov,
+				       ARRAY_SIZE(vq->iov),
+				       out_num, in_num, NULL, NULL);
+	u64 endtime;
+
+	if (r == vq->num && vq->busyloop_timeout) {
+		preempt_disable();
+		endtime = busy_clock() + vq->busyloop_timeout;
+		while (vhost_can_busy_poll(&net->dev, endtime) &&
+		       vhost_vq_avail_empty(vq))
+			cpu_relax();
+		preempt_enable();
+		r = vhost_get_vq_desc(&net->dev, vq, vq->iov,
+				      ARRAY_SIZE(vq->iov),
+				      out_num, in_num, NULL, NULL);
+	}
+
+	return r;
+}
+
 /* Caller must have TX VQ lock */
 static void tx_poll_stop(struct vhost_net *net)
 {
@@ -93,7 +133,7 @@ static void tx_poll_start(struct vhost_net *net, struct socket *sock)
 	net->tx_poll_state = VHOST_NET_POLL_STARTED;
 }
 
-/* Expects to be always run from workqueue - which acts as
+/* Expects to be always run from the worker - which acts as
  * read-size critical section for our kind of RCU. */
 static void handle_tx(struct vhost_net *net)
 {
@@ -122,7 +162,6 @@ static void handle_tx(struct vhost_net *net)
 		return;
 	}
 
-	use_mm(net->dev.mm);
 	mutex_lock(&vq->mutex);
 	vhost_disable_notify(vq);
 
@@ -131,10 +170,7 @@ static void handle_tx(struct vhost_net *net)
 	hdr_size = vq->hdr_size;
 
 	for (;;) {
-		head = vhost_get_vq_desc(&net->dev, vq, vq->iov,
-					 ARRAY_SIZE(vq->iov),
-					 &out, &in,
-					 NULL, NULL);
+		head = vhost_net_tx_get_vq_desc(net, vq, &out, &in);
 		/* Nothing new?  Wait for eventfd to tell us they refilled. */
 		if (head == vq->num) {
 			wmem = atomic_read(&sock->sk->sk_wmem_alloc);
@@ -184,10 +220,9 @@ static void handle_tx(struct vhost_net *net)
 	}
 
 	mutex_unlock(&vq->mutex);
-	unuse_mm(net->dev.mm);
 }
 
-/* Expects to be always run from workqueue - which acts as
+/* Expects to be always run from the worker - which acts as
  * read-size critical section for our kind of RCU. */
 static void handle_rx(struct vhost_net *net)
 {
@@ -215,7 +250,6 @@ static void handle_rx(struct vhost_net *net)
 	if (!sock || skb_queue_empty(&sock->sk->sk_receive_queue))
 		return;
 
-	use_mm(net->dev.mm);
 	mutex_lock(&vq->mutex);
 	vhost_disable_notify(vq);
 	hdr_size = vq->hdr_size;
@@ -291,10 +325,9 @@ static void handle_rx(struct vhost_net *net)
 	}
 
 	mutex_unlock(&vq->mutex);
-	unuse_mm(net->dev.mm);
 }
 
-static void handle_tx_kick(struct work_struct *work)
+static void handle_tx_kick(struct vhost_work *work)
 {
 	struct vhost_virtqueue *vq;
 	struct vhost_net *net;
@@ -303,7 +336,7 @@ static void handle_tx_kick(struct work_struct *work)
 	handle_tx(net);
 }
 
-static void handle_rx_kick(struct work_struct *work)
+static void handle_rx_kick(struct vhost_work *work)
 {
 	struct vhost_virtqueue *vq;
 	struct vhost_net *net;
@@ -312,14 +345,14 @@ static void handle_rx_kick(struct work_struct *work)
 	handle_rx(net);
 }
 
-static void handle_tx_net(struct work_struct *work)
+static void handle_tx_net(struct vhost_work *work)
 {
 	struct vhost_net *net;
 	net = container_of(work, struct vhost_net, poll[VHOST_NET_VQ_TX].work);
 	handle_tx(net);
 }
 
-static void handle_rx_net(struct work_struct *work)
+static void handle_rx_net(struct vhost_work *work)
 {
 	struct vhost_net *net;
 	net = container_of(work, struct vhost_net, poll[VHOST_NET_VQ_RX].work);
@@ -340,8 +373,10 @@ static int vhost_net_open(struct inode *inode, struct file *f)
 		return r;
 	}
 
-	vhost_poll_init(n->poll + VHOST_NET_VQ_TX, handle_tx_net, POLLOUT);
-	vhost_poll_init(n->poll + VHOST_NET_VQ_RX, handle_rx_net, POLLIN);
+	vhost_poll_init(n->poll + VHOST_NET_VQ_TX, handle_tx_net,
+			POLLOUT, &n->dev);
+	vhost_poll_init(n->poll + VHOST_NET_VQ_RX, handle_rx_net,
+			POLLIN, &n->dev);
 	n->tx_poll_state = VHOST_NET_POLL_DISABLED;
 
 	f->private_data = n;
@@ -644,25 +679,13 @@ static struct miscdevice vhost_net_misc = {
 
 int vhost_net_init(void)
 {
-	int r = vhost_init();
-	if (r)
-		goto err_init;
-	r = misc_register(&vhost_net_misc);
-	if (r)
-		goto err_reg;
-	return 0;
-err_reg:
-	vhost_cleanup();
-err_init:
-	return r;
-
+	return misc_register(&vhost_net_misc);
 }
 module_init(vhost_net_init);
 
 void vhost_net_exit(void)
 {
 	misc_deregister(&vhost_net_misc);
-	vhost_cleanup();
 }
 module_exit(vhost_net_exit);
 
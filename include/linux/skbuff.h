@@ -169,6 +169,8 @@ struct skb_shared_hwtstamps {
  * @software:		generate software time stamp
  * @in_progress:	device driver is going to provide
  *			hardware time stamp
+ * @zerocopy:		frags hold user pages, destructor_arg is the
+ *			&ubuf_info to release once they are freed
  * @flags:		all shared_tx flags
  *
  * These flags are attached to packets as part of the
@@ -178,11 +180,30 @@ union skb_shared_tx {
 	struct {
 		__u8	hardware:1,
 			software:1,
-			in_progress:1;
+			in_progress:1,
+			zerocopy:1;
 	};
 	__u8 flags;
 };
 
+/**
+ * struct ubuf_info - completion of a zero copy transmit
+ * @callback:	called once the last skb referencing the user pages is freed
+ * @refcnt:	one reference per skb data area holding the user pages,
+ *		plus one for the sender while it is still adding to them
+ * @id:		sequence number of the send call, reported to the socket
+ * @zerocopy:	clear if the data had to be copied after all
+ *
+ * Lives in the cb of the notification skb that is eventually queued on
+ * the socket error queue, see sock_zerocopy_alloc().
+ */
+struct ubuf_info {
+	void		(*callback)(struct ubuf_info *);
+	atomic_t	refcnt;
+	u32		id;
+	u8		zerocopy;
+};
+
 /* This data is invariant across clones and lives at
  * the end of the header data, ie. at skb->end.
  */
@@ -237,6 +258,11 @@ enum {
 	SKB_GSO_TCPV6 = 1 << 4,
 
 	SKB_GSO_FCOE = 1 << 5,
+
+	/* This indicates a train of equal sized UDP datagrams built by GRO,
+	 * gso_size being the payload of each datagram.
+	 */
+	SKB_GSO_UDP_L4 = 1 << 6,
 };
 
 #if BITS_PER_LONG > 32
@@ -294,10 +320,18 @@ typedef unsigned char *sk_buff_data_t;
  *	@nfct_reasm: netfilter conntrack re-assembly pointer
  *	@nf_bridge: Saved data about a bridged frame - see br_netfilter.c
  *	@skb_iif: ifindex of device we arrived on
+ *	@rxhash: the packet hash computed on receive
+ *	@napi_id: id of the NAPI context this skb was received by
  *	@queue_mapping: Queue mapping for multiqueue devices
  *	@tc_index: Traffic control index
  *	@tc_verd: traffic control verdict
  *	@ndisc_nodetype: router type (from link layer)
+ *	@xmit_more: more packets for the same tx queue follow right after
+ *		this one, the driver may defer notifying the hardware until
+ *		then or until ndo_xmit_flush()
+ *	@head_frag: skb->head is a page fragment, not kmalloc()ed
+ *	@ooo_okay: no earlier packet of the socket is still queued, the
+ *		stack may switch it to another tx queue
  *	@dma_cookie: a cookie to one of several possible DMA operations
  *		done by skb DMA functions
  *	@secmark: security marking
@@ -362,6 +396,10 @@ struct sk_buff {
 #endif
 
 	int			skb_iif;
+	__u32			rxhash;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	unsigned int		napi_id;
+#endif
 #ifdef CONFIG_NET_SCHED
 	__u16			tc_index;	/* traffic control index */
 #ifdef CONFIG_NET_CLS_ACT
@@ -374,6 +412,9 @@ struct sk_buff {
 #ifdef CONFIG_IPV6_NDISC_NODETYPE
 	__u8			ndisc_nodetype:2;
 #endif
+	__u8			xmit_more:1;
+	__u8			head_frag:1;
+	__u8			ooo_okay:1;
 	kmemcheck_bitfield_end(flags2);
 
 	/* 0/14 bit hole */
@@ -431,6 +472,7 @@ extern void consume_skb(struct sk_buff *skb);
 extern void	       __kfree_skb(struct sk_buff *skb);
 extern struct sk_buff *__alloc_skb(unsigned int size,
 				   gfp_t priority, int fclone, int node);
+extern struct sk_buff *build_skb(void *data, unsigned int frag_size);
 static inline struct sk_buff *alloc_skb(unsigned int size,
 					gfp_t priority)
 {
@@ -524,6 +566,29 @@ static inline union skb_shared_tx *skb_tx(struct sk_buff *skb)
 	return &skb_shinfo(skb)->tx_flags;
 }
 
+static inline struct ubuf_info *skb_zcopy(struct sk_buff *skb)
+{
+	return skb_shinfo(skb)->tx_flags.zerocopy ?
+	       skb_shinfo(skb)->destructor_arg : NULL;
+}
+
+extern struct ubuf_info *sock_zerocopy_alloc(struct sock *sk);
+extern void sock_zerocopy_put(struct ubuf_info *uarg);
+extern void sock_zerocopy_put_abort(struct ubuf_info *uarg);
+
+static inline void sock_zerocopy_get(struct ubuf_info *uarg)
+{
+	atomic_inc(&uarg->refcnt);
+}
+
+/* Make the frags of @skb keep @uarg's notification pending */
+static inline void skb_zcopy_set(struct sk_buff *skb, struct ubuf_info *uarg)
+{
+	sock_zerocopy_get(uarg);
+	skb_shinfo(skb)->destructor_arg = uarg;
+	skb_shinfo(skb)->tx_flags.zerocopy = 1;
+}
+
 /**
  *	skb_queue_empty - check if a queue is empty
  *	@list: queue head
@@ -1455,6 +1520,8 @@ static inline struct sk_buff *__dev_alloc_skb(unsigned int length,
 
 extern struct sk_buff *dev_alloc_skb(unsigned int length);
 
+extern void *netdev_alloc_frag(unsigned int fragsz);
+
 extern struct sk_buff *__netdev_alloc_skb(struct net_device *dev,
 		unsigned int length, gfp_t gfp_mask);
 
@@ -2036,6 +2103,15 @@ static inline bool skb_rx_queue_recorded(const struct sk_buff *skb)
 	return (skb->queue_mapping != 0);
 }
 
+extern __u32 __skb_get_rxhash(struct sk_buff *skb);
+static inline __u32 skb_get_rxhash(struct sk_buff *skb)
+{
+	if (!skb->rxhash)
+		skb->rxhash = __skb_get_rxhash(skb);
+
+	return skb->rxhash;
+}
+
 extern u16 skb_tx_hash(const struct net_device *dev,
 		       const struct sk_buff *skb);
 
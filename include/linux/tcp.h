@@ -105,6 +105,7 @@ enum {
 #define TCP_COOKIE_TRANSACTIONS	15	/* TCP Cookie Transactions */
 #define TCP_THIN_LINEAR_TIMEOUTS 16      /* Use linear timeouts for thin streams*/
 #define TCP_THIN_DUPACK         17      /* Fast retrans. after 1 dupack */
+#define TCP_FASTOPEN		23	/* Enable Fast Open on listeners */
 
 /* for TCP_INFO socket option */
 #define TCPI_OPT_TIMESTAMPS	1
@@ -270,7 +271,19 @@ static inline void tcp_clear_options(struct tcp_options_received *rx_opt)
  * only four options will fit in a standard TCP header */
 #define TCP_NUM_SACKS 4
 
+/* TCP Fast Open */
+#define TCP_FASTOPEN_COOKIE_MIN	4	/* Min Fast Open Cookie size in bytes */
+#define TCP_FASTOPEN_COOKIE_MAX	16	/* Max Fast Open Cookie size in bytes */
+#define TCP_FASTOPEN_COOKIE_SIZE 8	/* the size employed by this impl. */
+
+/* TCP Fast Open Cookie as stored in memory */
+struct tcp_fastopen_cookie {
+	s8	len;	/* -1 no option, 0 cookie request */
+	u8	val[TCP_FASTOPEN_COOKIE_MAX];
+};
+
 struct tcp_cookie_values;
+struct tcp_fastopen_request;
 struct tcp_request_sock_ops;
 
 struct tcp_request_sock {
@@ -281,6 +294,9 @@ struct tcp_request_sock {
 #endif
 	u32				rcv_isn;
 	u32				snt_isn;
+	u16				syn_data_len;	/* SYN data acked by SYN-ACK */
+	u8				fastopen_cookie_req; /* SYN-ACK carries cookie */
+	struct sock			*listener; /* Fast Open child's listener */
 };
 
 static inline struct tcp_request_sock *tcp_rsk(const struct request_sock *req)
@@ -345,7 +361,8 @@ struct tcp_sock {
 	u8	nonagle     : 4,/* Disable Nagle algorithm?             */
 		thin_lto    : 1,/* Use linear timeouts for thin streams */
 		thin_dupack : 1,/* Fast retransmit on first dupack      */
-		unused      : 2;
+		syn_fastopen: 1,/* SYN includes Fast Open option	*/
+		syn_data    : 1;/* SYN includes data			*/
 
 /* RTT measurement */
 	u32	srtt;		/* smoothed round trip time << 3	*/
@@ -459,6 +476,25 @@ struct tcp_sock {
 	 * contains related tcp_cookie_transactions fields.
 	 */
 	struct tcp_cookie_values  *cookie_values;
+
+/* TCP Fast Open */
+	int	fastopen_qlen;	/* TCP_FASTOPEN: limit on fastopen_pending */
+	atomic_t fastopen_pending; /* Fast Open children in handshake	*/
+	struct tcp_fastopen_request *fastopen_req; /* MSG_FASTOPEN in progress */
+	/* Passive Fast Open child: the request it was created from, kept
+	 * to retransmit the SYN-ACK until the handshake completes.
+	 */
+	struct request_sock *fastopen_rsk;
+
+/* TCP Small Queues */
+	unsigned long	tsq_flags;
+	struct list_head tsq_node; /* anchor in tsq_tasklet.head list */
+};
+
+enum tsq_flags {
+	TSQ_THROTTLED,		/* tcp_write_xmit() stopped on the limit */
+	TSQ_QUEUED,		/* socket is on the tsq tasklet list */
+	TCP_TSQ_DEFERRED,	/* tasklet found the socket owned by user */
 };
 
 static inline struct tcp_sock *tcp_sk(const struct sock *sk)
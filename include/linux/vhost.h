@@ -112,6 +112,13 @@ struct vhost_memory {
 #define VHOST_SET_VRING_CALL _IOW(VHOST_VIRTIO, 0x21, struct vhost_vring_file)
 /* Set eventfd to signal an error */
 #define VHOST_SET_VRING_ERR _IOW(VHOST_VIRTIO, 0x22, struct vhost_vring_file)
+/* Set busy loop timeout (in us): how long to poll the ring for new buffers
+ * before enabling guest notifications again.  0 (default) disables it. */
+#define VHOST_SET_VRING_BUSYLOOP_TIMEOUT _IOW(VHOST_VIRTIO, 0x23,	\
+					 struct vhost_vring_state)
+/* Get accessor: reads index, writes value in num */
+#define VHOST_GET_VRING_BUSYLOOP_TIMEOUT _IOWR(VHOST_VIRTIO, 0x23,	\
+					  struct vhost_vring_state)
 
 /* VHOST_NET specific defines */
 
@@ -9,9 +9,11 @@
 extern void unix_inflight(struct file *fp);
 extern void unix_notinflight(struct file *fp);
 extern void unix_gc(void);
+extern void unix_gc_flush(void);
 extern void wait_for_unix_gc(void);
 
-#define UNIX_HASH_SIZE	256
+#define UNIX_HASH_BITS	8
+#define UNIX_HASH_SIZE	(1 << UNIX_HASH_BITS)
 
 extern unsigned int unix_tot_inflight;
 
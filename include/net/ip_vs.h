@@ -15,6 +15,10 @@
 
 #include <linux/sysctl.h>               /* for ctl_path */
 #include <linux/list.h>                 /* for struct list_head */
+#include <linux/list_nulls.h>           /* for struct hlist_nulls_node */
+#include <linux/rcupdate.h>             /* for struct rcu_head */
+#include <linux/percpu.h>               /* for per-cpu stats */
+#include <linux/seqlock.h>              /* for seqcount_t */
 #include <linux/spinlock.h>             /* for struct rwlock_t */
 #include <asm/atomic.h>                 /* for struct atomic_t */
 #include <linux/compiler.h>
@@ -276,13 +280,64 @@ struct ip_vs_estimator {
 	u32			outbps;
 };
 
+/*
+ *	Counters updated by the packet path.  Each cpu only touches its own
+ *	copy, the readers and the estimator add them up.  On 32bit SMP the
+ *	64bit byte counters are read under a seqcount.
+ */
+struct ip_vs_cpu_stats {
+	u64			inbytes;
+	u64			outbytes;
+	u32			conns;
+	u32			inpkts;
+	u32			outpkts;
+#if BITS_PER_LONG == 32 && defined(CONFIG_SMP)
+	seqcount_t		syncp;
+#endif
+};
+
 struct ip_vs_stats {
 	struct ip_vs_stats_user	ustats;         /* statistics */
 	struct ip_vs_estimator	est;		/* estimator */
+	struct ip_vs_cpu_stats __percpu *cpustats; /* per-cpu counters */
+	struct ip_vs_cpu_stats	base;		/* counters at last zeroing */
 
 	spinlock_t              lock;           /* spin lock */
 };
 
+static inline void ip_vs_cpu_stats_update_begin(struct ip_vs_cpu_stats *s)
+{
+#if BITS_PER_LONG == 32 && defined(CONFIG_SMP)
+	write_seqcount_begin(&s->syncp);
+#endif
+}
+
+static inline void ip_vs_cpu_stats_update_end(struct ip_vs_cpu_stats *s)
+{
+#if BITS_PER_LONG == 32 && defined(CONFIG_SMP)
+	write_seqcount_end(&s->syncp);
+#endif
+}
+
+static inline unsigned ip_vs_cpu_stats_fetch_begin(const struct ip_vs_cpu_stats *s)
+{
+#if BITS_PER_LONG == 32 && defined(CONFIG_SMP)
+	return read_seqcount_begin(&s->syncp);
+#else
+	return 0;
+#endif
+}
+
+static inline int ip_vs_cpu_stats_fetch_retry(const struct ip_vs_cpu_stats *s,
+					      unsigned start)
+{
+#if BITS_PER_LONG == 32 && defined(CONFIG_SMP)
+	return read_seqcount_retry(&s->syncp, start);
+#else
+	return 0;
+#endif
+}
+
 struct dst_entry;
 struct iphdr;
 struct ip_vs_conn;
@@ -359,7 +414,7 @@ extern struct ip_vs_protocol * ip_vs_proto_get(unsigned short proto);
  *	IP_VS structure allocated for each dynamically scheduled connection
  */
 struct ip_vs_conn {
-	struct list_head        c_list;         /* hashed list heads */
+	struct hlist_nulls_node c_list;         /* hashed list heads */
 
 	/* Protocol, addresses and port numbers */
 	u16                      af;		/* address family */
@@ -405,6 +460,8 @@ struct ip_vs_conn {
 	void                    *app_data;      /* Application private data */
 	struct ip_vs_seq        in_seq;         /* incoming seq. struct */
 	struct ip_vs_seq        out_seq;        /* outgoing seq. struct */
+
+	struct rcu_head		rcu_head;	/* for deferred freeing */
 };
 
 
@@ -836,6 +893,7 @@ extern void ip_vs_estimator_cleanup(void);
 extern void ip_vs_new_estimator(struct ip_vs_stats *stats);
 extern void ip_vs_kill_estimator(struct ip_vs_stats *stats);
 extern void ip_vs_zero_estimator(struct ip_vs_stats *stats);
+extern void ip_vs_read_stats(struct ip_vs_stats *stats);
 
 /*
  *	Various IPVS packet transmitters (from ip_vs_xmit.c)
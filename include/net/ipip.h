@@ -3,6 +3,7 @@
 
 #include <linux/if_tunnel.h>
 #include <net/ip.h>
+#include <net/gro_cells.h>
 
 /* Keep error state on tunnel for 30 sec */
 #define IPTUNNEL_ERR_TIMEO	(30*HZ)
@@ -27,6 +28,7 @@ struct ip_tunnel {
 	__u32			o_seqno;	/* The last output seqno */
 	int			hlen;		/* Precalculated GRE header length */
 	int			mlink;
+	struct gro_cells	gro_cells;
 
 	struct ip_tunnel_parm	parms;
 
@@ -74,6 +74,15 @@ print_tuple(struct seq_file *s, const struct nf_conntrack_tuple *tuple,
             const struct nf_conntrack_l3proto *l3proto,
             const struct nf_conntrack_l4proto *proto);
 
+/* Protects expectations and helper changes.  The conntrack hash itself
+ * is protected by nf_conntrack_locks, lock i covering every bucket b with
+ * b % CONNTRACK_LOCKS == i.  Nests outside of the bucket locks.
+ */
 extern spinlock_t nf_conntrack_lock ;
 
+#define CONNTRACK_LOCKS 1024
+
+extern spinlock_t nf_conntrack_locks[CONNTRACK_LOCKS];
+extern void nf_conntrack_bucket_lock(spinlock_t *lock);
+
 #endif /* _NF_CONNTRACK_CORE_H */
@@ -67,6 +67,8 @@ struct qdisc_watchdog {
 extern void qdisc_watchdog_init(struct qdisc_watchdog *wd, struct Qdisc *qdisc);
 extern void qdisc_watchdog_schedule(struct qdisc_watchdog *wd,
 				    psched_time_t expires);
+extern void qdisc_watchdog_schedule_ns(struct qdisc_watchdog *wd,
+				       u64 expires);
 extern void qdisc_watchdog_cancel(struct qdisc_watchdog *wd);
 
 extern struct Qdisc_ops pfifo_qdisc_ops;
@@ -93,6 +95,8 @@ extern int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 
 extern void __qdisc_run(struct Qdisc *q);
 
+extern int sysctl_qdisc_lockless;
+
 static inline void qdisc_run(struct Qdisc *q)
 {
 	if (!test_and_set_bit(__QDISC_STATE_RUNNING, &q->state))
@@ -44,6 +44,7 @@ struct Qdisc {
 #define TCQ_F_INGRESS		4
 #define TCQ_F_CAN_BYPASS	8
 #define TCQ_F_MQROOT		16
+#define TCQ_F_NOLOCK		32 /* enqueue/dequeue without qdisc_lock() */
 #define TCQ_F_WARN_NONWC	(1 << 16)
 	int			padded;
 	struct Qdisc_ops	*ops;
@@ -66,6 +67,8 @@ struct Qdisc {
 	struct Qdisc		*next_sched;
 
 	struct sk_buff		*gso_skb;
+	/* queue length, backlog and drops of a TCQ_F_NOLOCK qdisc */
+	struct gnet_stats_queue __percpu *cpu_qstats;
 	/*
 	 * For performance sake on SMP, we put highly modified fields at the end
 	 */
@@ -396,6 +399,55 @@ static inline void __qdisc_update_bstats(struct Qdisc *sch, unsigned int len)
 	sch->bstats.packets++;
 }
 
+/*
+ * A TCQ_F_NOLOCK qdisc is enqueued to concurrently from several cpus, so
+ * it keeps qlen, backlog and drops per cpu (BH disabled) and only folds
+ * them into q.qlen and qstats when they are dumped.
+ */
+static inline void qdisc_qstats_cpu_backlog_inc(struct Qdisc *sch,
+						struct sk_buff *skb)
+{
+	struct gnet_stats_queue *qstats = this_cpu_ptr(sch->cpu_qstats);
+
+	qstats->qlen++;
+	qstats->backlog += qdisc_pkt_len(skb);
+}
+
+static inline void qdisc_qstats_cpu_backlog_dec(struct Qdisc *sch,
+						struct sk_buff *skb)
+{
+	struct gnet_stats_queue *qstats = this_cpu_ptr(sch->cpu_qstats);
+
+	qstats->qlen--;
+	qstats->backlog -= qdisc_pkt_len(skb);
+}
+
+static inline void qdisc_qstats_cpu_drop(struct Qdisc *sch)
+{
+	this_cpu_ptr(sch->cpu_qstats)->drops++;
+}
+
+static inline void qdisc_fold_cpu_qstats(struct Qdisc *sch)
+{
+	__u32 qlen = 0, backlog = 0, drops = 0;
+	int i;
+
+	if (!(sch->flags & TCQ_F_NOLOCK))
+		return;
+
+	for_each_possible_cpu(i) {
+		const struct gnet_stats_queue *qstats;
+
+		qstats = per_cpu_ptr(sch->cpu_qstats, i);
+		qlen += qstats->qlen;
+		backlog += qstats->backlog;
+		drops += qstats->drops;
+	}
+	sch->q.qlen = qlen;
+	sch->qstats.backlog = backlog;
+	sch->qstats.drops = drops;
+}
+
 static inline int __qdisc_enqueue_tail(struct sk_buff *skb, struct Qdisc *sch,
 				       struct sk_buff_head *list)
 {
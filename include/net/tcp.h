@@ -166,6 +166,11 @@ extern void tcp_time_wait(struct sock *sk, int state, int timeo);
 #define TCPOPT_TIMESTAMP	8	/* Better RTT estimations/PAWS */
 #define TCPOPT_MD5SIG		19	/* MD5 Signature (RFC2385) */
 #define TCPOPT_COOKIE		253	/* Cookie extension (experimental) */
+#define TCPOPT_EXP		254	/* Experimental */
+/* Magic number to be after the option value for sharing TCP
+ * experimental options. See draft-ietf-tcpm-experimental-options-00.txt
+ */
+#define TCPOPT_FASTOPEN_MAGIC	0xF989
 
 /*
  *     TCP option lengths
@@ -180,6 +185,7 @@ extern void tcp_time_wait(struct sock *sk, int state, int timeo);
 #define TCPOLEN_COOKIE_PAIR    3	/* Cookie pair header extension */
 #define TCPOLEN_COOKIE_MIN     (TCPOLEN_COOKIE_BASE+TCP_COOKIE_MIN)
 #define TCPOLEN_COOKIE_MAX     (TCPOLEN_COOKIE_BASE+TCP_COOKIE_MAX)
+#define TCPOLEN_EXP_FASTOPEN_BASE  4
 
 /* But this is what stacks really send out. */
 #define TCPOLEN_TSTAMP_ALIGNED		12
@@ -246,6 +252,8 @@ extern int sysctl_tcp_max_ssthresh;
 extern int sysctl_tcp_cookie_size;
 extern int sysctl_tcp_thin_linear_timeouts;
 extern int sysctl_tcp_thin_dupack;
+extern int sysctl_tcp_fastopen;
+extern int sysctl_tcp_limit_output_bytes;
 
 extern atomic_t tcp_memory_allocated;
 extern struct percpu_counter tcp_sockets_allocated;
@@ -415,7 +423,8 @@ extern int			tcp_recvmsg(struct kiocb *iocb, struct sock *sk,
 extern void			tcp_parse_options(struct sk_buff *skb,
 						  struct tcp_options_received *opt_rx,
 						  u8 **hvpp,
-						  int estab);
+						  int estab,
+						  struct tcp_fastopen_cookie *foc);
 
 extern u8			*tcp_parse_md5sig_option(struct tcphdr *th);
 
@@ -450,7 +459,8 @@ extern int			tcp_connect(struct sock *sk);
 extern struct sk_buff *		tcp_make_synack(struct sock *sk,
 						struct dst_entry *dst,
 						struct request_sock *req,
-						struct request_values *rvp);
+						struct request_values *rvp,
+						struct tcp_fastopen_cookie *foc);
 
 extern int			tcp_disconnect(struct sock *sk, int flags);
 
@@ -489,6 +499,8 @@ extern void tcp_send_fin(struct sock *sk);
 extern void tcp_send_active_reset(struct sock *sk, gfp_t priority);
 extern int  tcp_send_synack(struct sock *);
 extern void tcp_push_one(struct sock *, unsigned int mss_now);
+extern void tcp_release_cb(struct sock *sk);
+extern void tcp_tasklet_init(void);
 extern void tcp_send_ack(struct sock *sk);
 extern void tcp_send_delayed_ack(struct sock *sk);
 
@@ -1003,6 +1015,8 @@ static inline void tcp_openreq_init(struct request_sock *req,
 	req->rcv_wnd = 0;		/* So that tcp_send_synack() knows! */
 	req->cookie_ts = 0;
 	tcp_rsk(req)->rcv_isn = TCP_SKB_CB(skb)->seq;
+	tcp_rsk(req)->syn_data_len = 0;
+	tcp_rsk(req)->fastopen_cookie_req = 0;
 	req->mss = rx_opt->mss_clamp;
 	req->ts_recent = rx_opt->saw_tstamp ? rx_opt->rcv_tsval : 0;
 	ireq->tstamp_ok = rx_opt->tstamp_ok;
@@ -1561,6 +1575,57 @@ static inline struct tcp_extend_values *tcp_xv(struct request_values *rvp)
 	return (struct tcp_extend_values *)rvp;
 }
 
+/* sysctl_tcp_fastopen bits */
+#define TFO_CLIENT_ENABLE	1	/* send data in SYN on MSG_FASTOPEN */
+#define TFO_SERVER_ENABLE	2	/* accept data in SYN on TCP_FASTOPEN
+					 * listeners */
+
+/**
+ *	struct tcp_fastopen_request - sendmsg(MSG_FASTOPEN) in progress.
+ *
+ * @cookie:	cookie cached for the destination.  Zero length asks the
+ *		server for one, -1 sends no option at all.
+ * @data:	user data to be carried in the SYN.
+ * @size:	length of @data.
+ * @copied:	bytes of @data queued by tcp_connect().
+ */
+struct tcp_fastopen_request {
+	struct tcp_fastopen_cookie	cookie;
+	struct msghdr			*data;
+	size_t				size;
+	int				copied;
+};
+
+/* Child socket handed to accept() before the handshake completed.  It
+ * may already be in FIN_WAIT1 if the application wrote and closed it.
+ */
+static inline int tcp_passive_fastopen(const struct sock *sk)
+{
+	return (sk->sk_state == TCP_SYN_RECV ||
+		sk->sk_state == TCP_FIN_WAIT1) &&
+	       tcp_sk(sk)->fastopen_rsk != NULL;
+}
+
+/* The handshake of a passive Fast Open child is over, one way or another. */
+static inline void tcp_fastopen_rsk_free(struct sock *sk)
+{
+	struct request_sock *req = tcp_sk(sk)->fastopen_rsk;
+	struct sock *listener = tcp_rsk(req)->listener;
+
+	atomic_dec(&tcp_sk(listener)->fastopen_pending);
+	sock_put(listener);
+	reqsk_free(req);
+	tcp_sk(sk)->fastopen_rsk = NULL;
+}
+
+/* From tcp_fastopen.c */
+extern void tcp_fastopen_cookie_gen(__be32 saddr, __be32 daddr,
+				    struct tcp_fastopen_cookie *foc);
+extern void tcp_fastopen_cache_get(struct sock *sk, u16 *mss,
+				   struct tcp_fastopen_cookie *cookie);
+extern void tcp_fastopen_cache_set(struct sock *sk, u16 mss,
+				   struct tcp_fastopen_cookie *cookie);
+
 extern void tcp_v4_init(void);
 extern void tcp_init(void);
 
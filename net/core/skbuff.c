@@ -240,6 +240,138 @@ nodata:
 }
 EXPORT_SYMBOL(__alloc_skb);
 
+/**
+ *	build_skb - build a network buffer around a data buffer
+ *	@data: data buffer provided by caller
+ *	@frag_size: size of @data if it is a page fragment, 0 if kmalloc()ed
+ *
+ *	Allocate a new &sk_buff whose head is @data, which must have room
+ *	for a trailing &skb_shared_info.  This lets drivers map buffers for
+ *	receive before any &sk_buff exists, and only touch one when a packet
+ *	actually arrived.  The head is freed with put_page() if @frag_size
+ *	is not zero.
+ *
+ *	%NULL is returned if there is no free memory, @data is left to the
+ *	caller then.
+ */
+struct sk_buff *build_skb(void *data, unsigned int frag_size)
+{
+	struct skb_shared_info *shinfo;
+	struct sk_buff *skb;
+	unsigned int size = frag_size ? : ksize(data);
+
+	skb = kmem_cache_alloc(skbuff_head_cache, GFP_ATOMIC);
+	if (!skb)
+		return NULL;
+
+	size -= SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
+
+	memset(skb, 0, offsetof(struct sk_buff, tail));
+	skb->truesize = size + sizeof(struct sk_buff);
+	skb->head_frag = frag_size != 0;
+	atomic_set(&skb->users, 1);
+	skb->head = data;
+	skb->data = data;
+	skb_reset_tail_pointer(skb);
+	skb->end = skb->tail + size;
+	kmemcheck_annotate_bitfield(skb, flags1);
+	kmemcheck_annotate_bitfield(skb, flags2);
+#ifdef NET_SKBUFF_DATA_USES_OFFSET
+	skb->mac_header = ~0U;
+#endif
+
+	/* make sure we initialize shinfo sequentially */
+	shinfo = skb_shinfo(skb);
+	atomic_set(&shinfo->dataref, 1);
+	shinfo->nr_frags  = 0;
+	shinfo->gso_size = 0;
+	shinfo->gso_segs = 0;
+	shinfo->gso_type = 0;
+	shinfo->ip6_frag_id = 0;
+	shinfo->tx_flags.flags = 0;
+	skb_frag_list_init(skb);
+	memset(&shinfo->hwtstamps, 0, sizeof(shinfo->hwtstamps));
+
+	return skb;
+}
+EXPORT_SYMBOL(build_skb);
+
+/*
+ * Per cpu cache of a high order page that skb heads are carved from.  The
+ * page refcount is raised once by a large bias instead of once per
+ * fragment; when the page is used up and every fragment given out has
+ * been freed again (refcount back at the bias), it is reused in place
+ * instead of going back to the page allocator.
+ */
+#define NETDEV_FRAG_PAGE_MAX_ORDER	get_order(32768)
+#define NETDEV_FRAG_PAGE_MAX_SIZE	(PAGE_SIZE << NETDEV_FRAG_PAGE_MAX_ORDER)
+#define NETDEV_PAGECNT_MAX_BIAS		NETDEV_FRAG_PAGE_MAX_SIZE
+
+struct netdev_alloc_cache {
+	struct page	*page;
+	unsigned int	size;
+	unsigned int	offset;
+	unsigned int	pagecnt_bias;
+};
+static DEFINE_PER_CPU(struct netdev_alloc_cache, netdev_alloc_cache);
+
+/**
+ *	netdev_alloc_frag - allocate a page fragment
+ *	@fragsz: fragment size
+ *
+ *	Allocates a fragment of at most PAGE_SIZE bytes from a per cpu page
+ *	cache, for use as an skb head with build_skb().  Can be called from
+ *	any context.  The fragment is released with
+ *	put_page(virt_to_head_page(data)).
+ *
+ *	%NULL is returned if there is no free memory.
+ */
+void *netdev_alloc_frag(unsigned int fragsz)
+{
+	struct netdev_alloc_cache *nc;
+	unsigned long flags;
+	void *data = NULL;
+	int order;
+
+	local_irq_save(flags);
+	nc = &__get_cpu_var(netdev_alloc_cache);
+	if (unlikely(!nc->page)) {
+refill:
+		for (order = NETDEV_FRAG_PAGE_MAX_ORDER; ;) {
+			gfp_t gfp = GFP_ATOMIC | __GFP_COLD;
+
+			if (order)
+				gfp |= __GFP_COMP | __GFP_NOWARN;
+			nc->page = alloc_pages(gfp, order);
+			if (likely(nc->page))
+				break;
+			if (--order < 0)
+				goto end;
+		}
+		nc->size = PAGE_SIZE << order;
+recycle:
+		atomic_set(&nc->page->_count, NETDEV_PAGECNT_MAX_BIAS);
+		nc->pagecnt_bias = NETDEV_PAGECNT_MAX_BIAS;
+		nc->offset = 0;
+	}
+
+	if (nc->offset + fragsz > nc->size) {
+		/* all fragments freed already: reuse the page as is */
+		if (atomic_read(&nc->page->_count) == nc->pagecnt_bias ||
+		    atomic_sub_and_test(nc->pagecnt_bias, &nc->page->_count))
+			goto recycle;
+		goto refill;
+	}
+
+	data = page_address(nc->page) + nc->offset;
+	nc->offset += fragsz;
+	nc->pagecnt_bias--;
+end:
+	local_irq_restore(flags);
+	return data;
+}
+EXPORT_SYMBOL(netdev_alloc_frag);
+
 /**
  *	__netdev_alloc_skb - allocate an skbuff for rx on a specific device
  *	@dev: network device to receive on
@@ -257,9 +389,23 @@ struct sk_buff *__netdev_alloc_skb(struct net_device *dev,
 		unsigned int length, gfp_t gfp_mask)
 {
 	int node = dev->dev.parent ? dev_to_node(dev->dev.parent) : -1;
+	unsigned int fragsz = SKB_DATA_ALIGN(length + NET_SKB_PAD) +
+			      SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
 	struct sk_buff *skb;
 
-	skb = __alloc_skb(length + NET_SKB_PAD, gfp_mask, 0, node);
+	/* Carve small atomic rx buffers out of the per cpu page cache */
+	if (fragsz <= PAGE_SIZE && !(gfp_mask & (__GFP_WAIT | GFP_DMA))) {
+		void *data = netdev_alloc_frag(fragsz);
+
+		skb = NULL;
+		if (likely(data)) {
+			skb = build_skb(data, fragsz);
+			if (unlikely(!skb))
+				put_page(virt_to_head_page(data));
+		}
+	} else {
+		skb = __alloc_skb(length + NET_SKB_PAD, gfp_mask, 0, node);
+	}
 	if (likely(skb)) {
 		skb_reserve(skb, NET_SKB_PAD);
 		skb->dev = dev;
@@ -336,6 +482,14 @@ static void skb_clone_fraglist(struct sk_buff *skb)
 		skb_get(list);
 }
 
+static void skb_free_head(struct sk_buff *skb)
+{
+	if (skb->head_frag)
+		put_page(virt_to_head_page(skb->head));
+	else
+		kfree(skb->head);
+}
+
 static void skb_release_data(struct sk_buff *skb)
 {
 	if (!skb->cloned ||
@@ -347,10 +501,13 @@ static void skb_release_data(struct sk_buff *skb)
 				put_page(skb_shinfo(skb)->frags[i].page);
 		}
 
+		if (skb_zcopy(skb))
+			sock_zerocopy_put(skb_zcopy(skb));
+
 		if (skb_has_frags(skb))
 			skb_drop_fraglist(skb);
 
-		kfree(skb->head);
+		skb_free_head(skb);
 	}
 }
 
@@ -499,6 +656,10 @@ int skb_recycle_check(struct sk_buff *skb, int skb_size)
 	if (skb_is_nonlinear(skb) || skb->fclone != SKB_FCLONE_UNAVAILABLE)
 		return 0;
 
+	/* page fragment heads are recycled by netdev_alloc_frag() */
+	if (skb->head_frag)
+		return 0;
+
 	skb_size = SKB_DATA_ALIGN(skb_size + NET_SKB_PAD);
 	if (skb_end_pointer(skb) - skb->head < skb_size)
 		return 0;
@@ -550,6 +711,10 @@ static void __copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 	new->protocol		= old->protocol;
 	new->mark		= old->mark;
 	new->skb_iif		= old->skb_iif;
+	new->rxhash		= old->rxhash;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	new->napi_id		= old->napi_id;
+#endif
 	__nf_copy(new, old);
 #if defined(CONFIG_NETFILTER_XT_TARGET_TRACE) || \
     defined(CONFIG_NETFILTER_XT_TARGET_TRACE_MODULE)
@@ -588,6 +753,7 @@ static struct sk_buff *__skb_clone(struct sk_buff *n, struct sk_buff *skb)
 	C(tail);
 	C(end);
 	C(head);
+	C(head_frag);
 	C(data);
 	C(truesize);
 	atomic_set(&n->users, 1);
@@ -768,6 +934,8 @@ struct sk_buff *pskb_copy(struct sk_buff *skb, gfp_t gfp_mask)
 			get_page(skb_shinfo(n)->frags[i].page);
 		}
 		skb_shinfo(n)->nr_frags = i;
+		if (skb_zcopy(skb))
+			skb_zcopy_set(n, skb_zcopy(skb));
 	}
 
 	if (skb_has_frags(skb)) {
@@ -833,6 +1001,10 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 	for (i = 0; i < skb_shinfo(skb)->nr_frags; i++)
 		get_page(skb_shinfo(skb)->frags[i].page);
 
+	/* The copied shared info refers to the same user pages */
+	if (skb_zcopy(skb))
+		sock_zerocopy_get(skb_zcopy(skb));
+
 	if (skb_has_frags(skb))
 		skb_clone_fraglist(skb);
 
@@ -841,6 +1013,7 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 	off = (data + nhead) - skb->head;
 
 	skb->head     = data;
+	skb->head_frag = 0;
 	skb->data    += off;
 #ifdef NET_SKBUFF_DATA_USES_OFFSET
 	skb->end      = size;
@@ -2084,6 +2257,9 @@ void skb_split(struct sk_buff *skb, struct sk_buff *skb1, const u32 len)
 {
 	int pos = skb_headlen(skb);
 
+	if (skb_zcopy(skb))
+		skb_zcopy_set(skb1, skb_zcopy(skb));
+
 	if (len < pos)	/* Split line is inside header. */
 		skb_split_inside_header(skb, skb1, len, pos);
 	else		/* Second chunk has no header, nothing to copy. */
@@ -2126,6 +2302,10 @@ int skb_shift(struct sk_buff *tgt, struct sk_buff *skb, int shiftlen)
 	BUG_ON(shiftlen > skb->len);
 	BUG_ON(skb_headlen(skb));	/* Would corrupt stream */
 
+	/* Frags from different zero copy sends complete separately */
+	if (skb_zcopy(tgt) != skb_zcopy(skb))
+		return 0;
+
 	todo = shiftlen;
 	from = 0;
 	to = skb_shinfo(tgt)->nr_frags;
@@ -2595,6 +2775,9 @@ struct sk_buff *skb_segment(struct sk_buff *skb, int features)
 			continue;
 		}
 
+		if (skb_zcopy(skb))
+			skb_zcopy_set(nskb, skb_zcopy(skb));
+
 		frag = skb_shinfo(nskb)->frags;
 
 		skb_copy_from_linear_data_offset(skb, offset,
@@ -2971,6 +3154,37 @@ int skb_cow_data(struct sk_buff *skb, int tailbits, struct sk_buff **trailer)
 }
 EXPORT_SYMBOL_GPL(skb_cow_data);
 
+static void sock_rmem_free(struct sk_buff *skb)
+{
+	struct sock *sk = skb->sk;
+
+	atomic_sub(skb->truesize, &sk->sk_rmem_alloc);
+}
+
+/*
+ * Note: error packets are not memory charged (no sk_forward_alloc
+ * changes), they can be queued from irq context without the socket lock.
+ */
+int sock_queue_err_skb(struct sock *sk, struct sk_buff *skb)
+{
+	int len = skb->len;
+
+	if (atomic_read(&sk->sk_rmem_alloc) + skb->truesize >=
+	    (unsigned)sk->sk_rcvbuf)
+		return -ENOMEM;
+
+	skb_orphan(skb);
+	skb->sk = sk;
+	skb->destructor = sock_rmem_free;
+	atomic_add(skb->truesize, &sk->sk_rmem_alloc);
+
+	skb_queue_tail(&sk->sk_error_queue, skb);
+	if (!sock_flag(sk, SOCK_DEAD))
+		sk->sk_data_ready(sk, len);
+	return 0;
+}
+EXPORT_SYMBOL(sock_queue_err_skb);
+
 void skb_tstamp_tx(struct sk_buff *orig_skb,
 		struct skb_shared_hwtstamps *hwtstamps)
 {
@@ -3008,6 +3222,110 @@ void skb_tstamp_tx(struct sk_buff *orig_skb,
 }
 EXPORT_SYMBOL_GPL(skb_tstamp_tx);
 
+static void sock_zerocopy_ofree(struct sk_buff *skb)
+{
+	atomic_sub(skb->truesize, &skb->sk->sk_omem_alloc);
+}
+
+static void sock_zerocopy_callback(struct ubuf_info *uarg)
+{
+	struct sk_buff *skb = container_of((void *)uarg, struct sk_buff, cb);
+	struct sock *sk = skb->sk;
+	struct sk_buff_head *q = &sk->sk_error_queue;
+	struct sock_exterr_skb *serr;
+	struct sk_buff *tail;
+	unsigned long flags;
+	u32 id = uarg->id;
+	u8 code = uarg->zerocopy ? 0 : SO_EE_CODE_ZEROCOPY_COPIED;
+	int merged = 0;
+
+	/* uarg and serr share skb->cb, so read everything out first */
+	serr = SKB_EXT_ERR(skb);
+	memset(serr, 0, sizeof(*serr));
+	serr->ee.ee_origin = SO_EE_ORIGIN_ZEROCOPY;
+	serr->ee.ee_code = code;
+	serr->ee.ee_info = id;
+	serr->ee.ee_data = id;
+
+	/* Sends complete in order in the common case: extend the range of
+	 * a notification that is still queued instead of adding another.
+	 */
+	spin_lock_irqsave(&q->lock, flags);
+	tail = skb_peek_tail(q);
+	if (tail && SKB_EXT_ERR(tail)->ee.ee_origin == SO_EE_ORIGIN_ZEROCOPY &&
+	    SKB_EXT_ERR(tail)->ee.ee_code == code &&
+	    SKB_EXT_ERR(tail)->ee.ee_data + 1 == id) {
+		SKB_EXT_ERR(tail)->ee.ee_data = id;
+		merged = 1;
+	}
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	if (merged || sock_queue_err_skb(sk, skb))
+		kfree_skb(skb);
+
+	sock_put(sk);
+}
+
+/**
+ *	sock_zerocopy_alloc - start a %MSG_ZEROCOPY send
+ *	@sk: sending socket
+ *
+ *	Allocates the notification that is queued on the error queue of
+ *	@sk once all skbs built from the user pages of this send have been
+ *	freed. The caller owns one reference, dropped with
+ *	sock_zerocopy_put() or, if nothing was sent, sock_zerocopy_put_abort().
+ *	The notification is charged against %sysctl_optmem_max.
+ */
+struct ubuf_info *sock_zerocopy_alloc(struct sock *sk)
+{
+	struct ubuf_info *uarg;
+	struct sk_buff *skb;
+
+	BUILD_BUG_ON(sizeof(*uarg) > sizeof(skb->cb));
+
+	if (atomic_read(&sk->sk_omem_alloc) >= sysctl_optmem_max)
+		return NULL;
+
+	skb = alloc_skb(0, sk->sk_allocation);
+	if (!skb)
+		return NULL;
+
+	atomic_add(skb->truesize, &sk->sk_omem_alloc);
+	skb->sk = sk;
+	skb->destructor = sock_zerocopy_ofree;
+	sock_hold(sk);
+
+	uarg = (void *)skb->cb;
+	uarg->callback = sock_zerocopy_callback;
+	uarg->id = sk->sk_zckey++;
+	uarg->zerocopy = 1;
+	atomic_set(&uarg->refcnt, 1);
+
+	return uarg;
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_alloc);
+
+void sock_zerocopy_put(struct ubuf_info *uarg)
+{
+	if (atomic_dec_and_test(&uarg->refcnt))
+		uarg->callback(uarg);
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put);
+
+/* Nothing was queued: give the id back and drop the notification */
+void sock_zerocopy_put_abort(struct ubuf_info *uarg)
+{
+	struct sk_buff *skb = container_of((void *)uarg, struct sk_buff, cb);
+	struct sock *sk = skb->sk;
+
+	sk->sk_zckey--;
+	if (atomic_dec_and_test(&uarg->refcnt)) {
+		kfree_skb(skb);
+		sock_put(sk);
+	}
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put_abort);
+
 
 /**
  * skb_partial_csum_set - set up and verify partial csum values for packet
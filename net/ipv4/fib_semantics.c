@@ -146,6 +146,7 @@ void free_fib_info(struct fib_info *fi)
 		return;
 	}
 	change_nexthops(fi) {
+		rt_nh_cache_release(nexthop_nh);
 		if (nexthop_nh->nh_dev)
 			dev_put(nexthop_nh->nh_dev);
 		nexthop_nh->nh_dev = NULL;
@@ -1078,6 +1079,8 @@ int fib_sync_down_dev(struct net_device *dev, int force)
 		prev_fi = fi;
 		dead = 0;
 		change_nexthops(fi) {
+			if (nexthop_nh->nh_dev == dev)
+				rt_nh_cache_release(nexthop_nh);
 			if (nexthop_nh->nh_flags&RTNH_F_DEAD)
 				dead++;
 			else if (nexthop_nh->nh_dev == dev &&
@@ -653,7 +653,13 @@ static int ipgre_rcv(struct sk_buff *skb)
 		skb_reset_network_header(skb);
 		ipgre_ecn_decapsulate(iph, skb);
 
-		netif_rx(skb);
+		/* Without header_ops nobody looks at the outer headers any
+		 * more; hide them so GRO only compares the inner packet.
+		 */
+		if (!tunnel->dev->header_ops)
+			skb->mac_header = skb->network_header;
+
+		gro_cells_receive(&tunnel->gro_cells, skb);
 		rcu_read_unlock();
 		return(0);
 	}
@@ -1221,10 +1227,18 @@ static const struct net_device_ops ipgre_netdev_ops = {
 	.ndo_change_mtu		= ipgre_tunnel_change_mtu,
 };
 
+static void ipgre_dev_free(struct net_device *dev)
+{
+	struct ip_tunnel *tunnel = netdev_priv(dev);
+
+	gro_cells_destroy(&tunnel->gro_cells);
+	free_netdev(dev);
+}
+
 static void ipgre_tunnel_setup(struct net_device *dev)
 {
 	dev->netdev_ops		= &ipgre_netdev_ops;
-	dev->destructor 	= free_netdev;
+	dev->destructor 	= ipgre_dev_free;
 
 	dev->type		= ARPHRD_IPGRE;
 	dev->needed_headroom 	= LL_MAX_HEADER + sizeof(struct iphdr) + 4;
@@ -1232,7 +1246,7 @@ static void ipgre_tunnel_setup(struct net_device *dev)
 	dev->flags		= IFF_NOARP;
 	dev->iflink		= 0;
 	dev->addr_len		= 4;
-	dev->features		|= NETIF_F_NETNS_LOCAL;
+	dev->features		|= NETIF_F_NETNS_LOCAL | NETIF_F_GRO;
 	dev->priv_flags		&= ~IFF_XMIT_DST_RELEASE;
 }
 
@@ -1262,7 +1276,7 @@ static int ipgre_tunnel_init(struct net_device *dev)
 	} else
 		dev->header_ops = &ipgre_header_ops;
 
-	return 0;
+	return gro_cells_init(&tunnel->gro_cells, dev);
 }
 
 static void ipgre_fb_tunnel_init(struct net_device *dev)
@@ -1447,7 +1461,7 @@ static int ipgre_tap_init(struct net_device *dev)
 
 	ipgre_tunnel_bind_dev(dev);
 
-	return 0;
+	return gro_cells_init(&tunnel->gro_cells, dev);
 }
 
 static const struct net_device_ops ipgre_tap_netdev_ops = {
@@ -1465,10 +1479,10 @@ static void ipgre_tap_setup(struct net_device *dev)
 	ether_setup(dev);
 
 	dev->netdev_ops		= &ipgre_tap_netdev_ops;
-	dev->destructor 	= free_netdev;
+	dev->destructor 	= ipgre_dev_free;
 
 	dev->iflink		= 0;
-	dev->features		|= NETIF_F_NETNS_LOCAL;
+	dev->features		|= NETIF_F_NETNS_LOCAL | NETIF_F_GRO;
 }
 
 static int ipgre_newlink(struct net *src_net, struct net_device *dev, struct nlattr *tb[],
@@ -252,6 +252,35 @@ static int ip_local_deliver_finish(struct sk_buff *skb)
 	return 0;
 }
 
+/*
+ *	UDP datagrams merged by GRO have been routed and filtered once as
+ *	a whole; split them up again so that sockets see every datagram.
+ */
+static int ip_local_deliver_segment(struct sk_buff *skb)
+{
+	struct sk_buff *segs, *next;
+
+	if (likely(!skb_is_gso(skb) ||
+		   !(skb_shinfo(skb)->gso_type & SKB_GSO_UDP_L4)))
+		return ip_local_deliver_finish(skb);
+
+	segs = skb_gso_segment(skb, NETIF_F_SG | NETIF_F_HW_CSUM);
+	if (IS_ERR(segs) || !segs) {
+		kfree_skb(skb);
+		return 0;
+	}
+	consume_skb(skb);
+
+	for (; segs; segs = next) {
+		next = segs->next;
+		segs->next = NULL;
+		segs->ip_summed = CHECKSUM_UNNECESSARY;
+		ip_local_deliver_finish(segs);
+	}
+
+	return 0;
+}
+
 /*
  * 	Deliver IP Packets to the higher protocol layers.
  */
@@ -267,7 +296,7 @@ int ip_local_deliver(struct sk_buff *skb)
 	}
 
 	return NF_HOOK(PF_INET, NF_INET_LOCAL_IN, skb, skb->dev, NULL,
-		       ip_local_deliver_finish);
+		       ip_local_deliver_segment);
 }
 
 static inline int ip_rcv_options(struct sk_buff *skb)
@@ -24,6 +24,9 @@
 #include <linux/proc_fs.h>
 #include <linux/err.h>
 #include <linux/cpumask.h>
+#include <linux/jhash.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
 
 #include <linux/netfilter/x_tables.h>
 #include <linux/netfilter_ipv4/ip_tables.h>
@@ -314,6 +317,111 @@ struct ipt_entry *ipt_next_entry(const struct ipt_entry *entry)
 	return (void *)entry + entry->next_offset;
 }
 
+/*
+ * Rule runs.
+ *
+ * Long chains are mostly made of consecutive rules which differ only in
+ * the addresses and the tcp/udp destination port they compare against.
+ * When the table is loaded such runs are compiled into a hash table
+ * keyed by the masked addresses and port, so a single lookup either
+ * finds the first rule of the run the packet can match or proves that
+ * none of them can and the whole run is skipped.  Rules that ask for
+ * anything else keep being walked one by one.
+ *
+ * The first entry of a compiled run carries the run number (plus one)
+ * in its otherwise unused nfcache field.
+ */
+#define IPT_RUN_MIN	4		/* shortest run worth a lookup */
+#define IPT_RUN_EMPTY	0xFFFFFFFF
+
+struct ipt_run_shape {
+	struct ipt_ip	ip;		/* interfaces and protocol, no addresses */
+	__be32		smsk;
+	__be32		dmsk;
+	bool		dport;		/* one tcp/udp destination port */
+};
+
+struct ipt_run_slot {
+	__be32		src;
+	__be32		dst;
+	__be16		dport;
+	unsigned int	offset;		/* of the rule, IPT_RUN_EMPTY if none */
+};
+
+struct ipt_run {
+	struct ipt_run_shape	shape;
+	unsigned int		end;	/* offset of the entry after the run */
+	unsigned int		hmask;
+	struct ipt_run_slot	*slots;
+};
+
+struct ipt_runs {
+	unsigned int		nruns;
+	struct ipt_run		run[0];
+};
+
+static inline unsigned int ipt_run_hash(const struct ipt_run *run, __be32 src,
+					__be32 dst, __be16 dport)
+{
+	return jhash_3words((__force u32)src, (__force u32)dst,
+			    (__force u32)dport, 0) & run->hmask;
+}
+
+/* Returns the entry the walk carries on with when it reaches the start of
+ * a compiled run: the first rule of the run that matches the packet, or
+ * the entry following the run if none does.  Packets the lookup cannot
+ * judge (non-first fragments and truncated headers) go through the run
+ * rule by rule so the matches see them as before.
+ */
+static struct ipt_entry *
+ipt_run_skip(const struct ipt_runs *runs, struct ipt_entry *e,
+	     const void *table_base, const struct sk_buff *skb,
+	     const struct iphdr *ip, const char *indev, const char *outdev,
+	     const struct xt_match_param *par)
+{
+	while (e->nfcache) {
+		const struct ipt_run *run = &runs->run[e->nfcache - 1];
+		const struct ipt_run_slot *slot;
+		__be32 src, dst;
+		__be16 dport = 0;
+		unsigned int h;
+
+		if (!ip_packet_match(ip, indev, outdev, &run->shape.ip, 0))
+			goto skip;
+
+		if (run->shape.dport) {
+			union {
+				struct tcphdr tcph;
+				struct udphdr udph;
+			} _hdr;
+			const struct udphdr *uh;
+
+			if (par->fragoff)
+				return e;
+			uh = skb_header_pointer(skb, par->thoff,
+						run->shape.ip.proto == IPPROTO_TCP ?
+						sizeof(struct tcphdr) :
+						sizeof(struct udphdr), &_hdr);
+			if (uh == NULL)
+				return e;
+			dport = uh->dest;
+		}
+
+		src = ip->saddr & run->shape.smsk;
+		dst = ip->daddr & run->shape.dmsk;
+		h = ipt_run_hash(run, src, dst, dport);
+		for (slot = &run->slots[h]; slot->offset != IPT_RUN_EMPTY;
+		     h = (h + 1) & run->hmask, slot = &run->slots[h]) {
+			if (slot->src == src && slot->dst == dst &&
+			    slot->dport == dport)
+				return get_entry(table_base, slot->offset);
+		}
+ skip:
+		e = get_entry(table_base, run->end);
+	}
+	return e;
+}
+
 /* Returns one of the generic firewall policies, like NF_ACCEPT. */
 unsigned int
 ipt_do_table(struct sk_buff *skb,
@@ -370,6 +478,9 @@ ipt_do_table(struct sk_buff *skb,
 
 		IP_NF_ASSERT(e);
 		IP_NF_ASSERT(back);
+		if (e->nfcache)
+			e = ipt_run_skip(private->runs, e, table_base, skb, ip,
+					 indev, outdev, &mtpar);
 		if (!ip_packet_match(ip, indev, outdev,
 		    &e->ip, mtpar.fragoff)) {
  no_match:
@@ -812,6 +923,173 @@ cleanup_entry(struct ipt_entry *e, struct net *net)
 	module_put(par.target->me);
 }
 
+/* Fills in the shape and key of a rule if it can be part of a run: it
+ * compares nothing but addresses, interfaces, the protocol and possibly
+ * a single tcp/udp destination port.
+ */
+static bool ipt_run_rule(const struct ipt_entry *e,
+			 struct ipt_run_shape *shape, struct ipt_run_slot *key)
+{
+	const struct ipt_entry_target *t = ipt_get_target_c(e);
+	const struct xt_entry_match *ematch;
+	unsigned int i, nmatch = 0;
+
+	if (e->ip.flags & ~IPT_F_GOTO ||
+	    e->ip.invflags & ~(IPT_INV_VIA_IN | IPT_INV_VIA_OUT) ||
+	    strcmp(t->u.kernel.target->name, IPT_ERROR_TARGET) == 0)
+		return false;
+
+	memset(shape, 0, sizeof(*shape));
+	memset(key, 0, sizeof(*key));
+
+	xt_ematch_foreach(ematch, e) {
+		const char *name = ematch->u.kernel.match->name;
+
+		if (nmatch++)
+			return false;
+		if (strcmp(name, "tcp") == 0 && e->ip.proto == IPPROTO_TCP) {
+			const struct xt_tcp *tcpinfo = (void *)ematch->data;
+
+			if (tcpinfo->option || tcpinfo->flg_mask ||
+			    tcpinfo->flg_cmp || tcpinfo->invflags ||
+			    tcpinfo->spts[0] != 0 || tcpinfo->spts[1] != 0xFFFF ||
+			    tcpinfo->dpts[0] != tcpinfo->dpts[1])
+				return false;
+			key->dport = htons(tcpinfo->dpts[0]);
+		} else if (strcmp(name, "udp") == 0 &&
+			   e->ip.proto == IPPROTO_UDP) {
+			const struct xt_udp *udpinfo = (void *)ematch->data;
+
+			if (udpinfo->invflags ||
+			    udpinfo->spts[0] != 0 || udpinfo->spts[1] != 0xFFFF ||
+			    udpinfo->dpts[0] != udpinfo->dpts[1])
+				return false;
+			key->dport = htons(udpinfo->dpts[0]);
+		} else {
+			return false;
+		}
+		shape->dport = true;
+	}
+
+	for (i = 0; i < IFNAMSIZ; i++) {
+		shape->ip.iniface[i] = e->ip.iniface[i] & e->ip.iniface_mask[i];
+		shape->ip.outiface[i] = e->ip.outiface[i] & e->ip.outiface_mask[i];
+	}
+	memcpy(shape->ip.iniface_mask, e->ip.iniface_mask, IFNAMSIZ);
+	memcpy(shape->ip.outiface_mask, e->ip.outiface_mask, IFNAMSIZ);
+	shape->ip.proto = e->ip.proto;
+	shape->ip.invflags = e->ip.invflags;
+	shape->smsk = e->ip.smsk.s_addr;
+	shape->dmsk = e->ip.dmsk.s_addr;
+
+	key->src = e->ip.src.s_addr;
+	key->dst = e->ip.dst.s_addr;
+	return true;
+}
+
+static inline unsigned int ipt_run_size(unsigned int len)
+{
+	return roundup_pow_of_two(2 * len);
+}
+
+static void ipt_run_insert(struct ipt_run *run, const struct ipt_run_slot *key,
+			   unsigned int offset)
+{
+	unsigned int h = ipt_run_hash(run, key->src, key->dst, key->dport);
+	struct ipt_run_slot *slot;
+
+	for (slot = &run->slots[h]; slot->offset != IPT_RUN_EMPTY;
+	     h = (h + 1) & run->hmask, slot = &run->slots[h]) {
+		/* An earlier rule with the same key always wins. */
+		if (slot->src == key->src && slot->dst == key->dst &&
+		    slot->dport == key->dport)
+			return;
+	}
+	*slot = *key;
+	slot->offset = offset;
+}
+
+/* Finds the runs of a checked table and compiles them into newinfo->runs.
+ * Must be called before the entries are copied to the other cpus.  Failing
+ * to allocate is not an error: the table is then simply walked linearly.
+ */
+static void ipt_compile_runs(struct xt_table_info *newinfo, void *entry0)
+{
+	struct ipt_run_shape shape, prev;
+	struct ipt_run_slot key, *slot;
+	struct ipt_entry *iter, *start = NULL;
+	unsigned int len = 0, nruns = 0, nslots = 0, i;
+	struct ipt_runs *runs;
+	size_t size;
+	bool simple;
+
+	/* First pass: mark each run start with the length of the run. */
+	xt_entry_foreach(iter, entry0, newinfo->size) {
+		iter->nfcache = 0;
+		simple = ipt_run_rule(iter, &shape, &key);
+		if (simple && len && memcmp(&shape, &prev, sizeof(shape)) == 0) {
+			len++;
+			continue;
+		}
+		if (len >= IPT_RUN_MIN) {
+			start->nfcache = len;
+			nruns++;
+			nslots += ipt_run_size(len);
+		}
+		start = iter;
+		prev = shape;
+		len = simple;
+	}
+	if (len >= IPT_RUN_MIN) {
+		start->nfcache = len;
+		nruns++;
+		nslots += ipt_run_size(len);
+	}
+	if (nruns == 0)
+		return;
+
+	size = sizeof(*runs) + nruns * sizeof(struct ipt_run) +
+	       nslots * sizeof(struct ipt_run_slot);
+	if (size <= PAGE_SIZE)
+		runs = kmalloc(size, GFP_KERNEL);
+	else
+		runs = vmalloc(size);
+	if (runs == NULL) {
+		xt_entry_foreach(iter, entry0, newinfo->size)
+			iter->nfcache = 0;
+		return;
+	}
+	runs->nruns = nruns;
+	slot = (void *)&runs->run[nruns];
+
+	/* Second pass: hash the rules of each run in order. */
+	i = 0;
+	xt_entry_foreach(iter, entry0, newinfo->size) {
+		struct ipt_entry *e = iter;
+		struct ipt_run *run;
+		unsigned int h;
+
+		if (iter->nfcache == 0)
+			continue;
+		run = &runs->run[i];
+		len = iter->nfcache;
+		iter->nfcache = ++i;
+
+		run->hmask = ipt_run_size(len) - 1;
+		run->slots = slot;
+		slot += run->hmask + 1;
+		for (h = 0; h <= run->hmask; h++)
+			run->slots[h].offset = IPT_RUN_EMPTY;
+
+		for (; len > 0; len--, e = ipt_next_entry(e)) {
+			ipt_run_rule(e, &run->shape, &key);
+			ipt_run_insert(run, &key, (void *)e - entry0);
+		}
+		run->end = (void *)e - entry0;
+	}
+	newinfo->runs = runs;
+}
+
 /* Checks and translates the user-supplied table segment (held in
    newinfo) */
 static int
@@ -889,6 +1167,8 @@ translate_table(struct net *net, struct xt_table_info *newinfo, void *entry0,
 		return ret;
 	}
 
+	ipt_compile_runs(newinfo, entry0);
+
 	/* And one copy for every other CPU */
 	for_each_possible_cpu(i) {
 		if (newinfo->entries[i] && newinfo->entries[i] != entry0)
@@ -996,7 +1276,9 @@ copy_entries_to_user(unsigned int total_size,
 		if (copy_to_user(userptr + off
 				 + offsetof(struct ipt_entry, counters),
 				 &counters[num],
-				 sizeof(counters[num])) != 0) {
+				 sizeof(counters[num])) != 0 ||
+		    put_user(0, (unsigned int __user *)(userptr + off
+				 + offsetof(struct ipt_entry, nfcache))) != 0) {
 			ret = -EFAULT;
 			goto free_counters;
 		}
@@ -1444,7 +1726,8 @@ compat_copy_entry_to_user(struct ipt_entry *e, void __user **dstptr,
 	ce = (struct compat_ipt_entry __user *)*dstptr;
 	if (copy_to_user(ce, e, sizeof(struct ipt_entry)) != 0 ||
 	    copy_to_user(&ce->counters, &counters[i],
-	    sizeof(counters[i])) != 0)
+	    sizeof(counters[i])) != 0 ||
+	    put_user(0, &ce->nfcache) != 0)
 		return -EFAULT;
 
 	*dstptr += sizeof(struct compat_ipt_entry);
@@ -1796,6 +2079,8 @@ translate_compat_table(struct net *net,
 		return ret;
 	}
 
+	ipt_compile_runs(newinfo, entry1);
+
 	/* And one copy for every other CPU */
 	for_each_possible_cpu(i)
 		if (newinfo->entries[i] && newinfo->entries[i] != entry1)
@@ -2095,7 +2380,7 @@ struct xt_table *ipt_register_table(struct net *net,
 	int ret;
 	struct xt_table_info *newinfo;
 	struct xt_table_info bootstrap
-		= { 0, 0, 0, { 0 }, { 0 }, { } };
+		= { 0, 0, 0, { 0 }, { 0 }, NULL, { } };
 	void *loc_cpu_entry;
 	struct xt_table *new_table;
 
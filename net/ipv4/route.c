@@ -131,6 +131,7 @@ static int ip_rt_min_pmtu __read_mostly		= 512 + 20 + 20;
 static int ip_rt_min_advmss __read_mostly	= 256;
 static int ip_rt_secret_interval __read_mostly	= 10 * 60 * HZ;
 static int rt_chain_length_max __read_mostly	= 20;
+static int ip_rt_cache_bypass __read_mostly;
 
 static struct delayed_work expires_work;
 static unsigned long expires_ljiffies;
@@ -678,7 +679,8 @@ static inline u32 rt_score(struct rtable *rt)
 
 static inline bool rt_caching(const struct net *net)
 {
-	return net->ipv4.current_rt_cache_rebuild_count <=
+	return !ip_rt_cache_bypass &&
+		net->ipv4.current_rt_cache_rebuild_count <=
 		net->ipv4.sysctl_rt_cache_rebuild_count;
 }
 
@@ -1979,6 +1981,75 @@ static void ip_handle_martian_source(struct net_device *dev,
 #endif
 }
 
+/*
+ * With the route cache bypassed every forwarded packet would need an rtable
+ * of its own.  A route via a gateway does not depend on the destination
+ * address though, so one entry per nexthop is kept on the fib_info and
+ * shared by all flows arriving on the same interface.
+ */
+static inline bool rt_nh_input_cacheable(struct sk_buff *skb,
+					 struct fib_result *res,
+					 unsigned flags, u32 itag)
+{
+	struct fib_nh *nh = &FIB_RES_NH(*res);
+
+	return ip_rt_cache_bypass && res->fi && nh->nh_gw &&
+	       nh->nh_scope == RT_SCOPE_LINK &&
+	       !(flags & RTCF_DOREDIRECT) && !itag &&
+	       skb->protocol == htons(ETH_P_IP) &&
+	       ip_hdr(skb)->ihl == 5;	/* options use rt_dst/rt_src */
+}
+
+static struct rtable *rt_nh_input_get(struct fib_nh *nh, int iif,
+				      unsigned flags)
+{
+	struct rtable *rth;
+
+	rcu_read_lock_bh();
+	rth = rcu_dereference_bh(nh->nh_rth_input);
+	if (rth && (rth->fl.iif != iif || rth->rt_flags != flags ||
+		    rt_is_expired(rth)))
+		rth = NULL;
+	if (rth)
+		dst_use(&rth->u.dst, jiffies);
+	rcu_read_unlock_bh();
+
+	return rth;
+}
+
+static void rt_nh_input_set(struct fib_nh *nh, struct rtable *rth)
+{
+	struct rtable *old;
+
+	dst_hold(&rth->u.dst);
+	old = xchg(&nh->nh_rth_input, rth);
+	if (old) {
+		dst_release(&old->u.dst);
+		rt_free(old);
+	}
+}
+
+/**
+ *	rt_nh_cache_release - drop the route kept on a nexthop
+ *	@nh: nexthop
+ *
+ *	Called when the nexthop goes away or its device goes down.
+ */
+void rt_nh_cache_release(struct fib_nh *nh)
+{
+	struct rtable *old = xchg(&nh->nh_rth_input, NULL);
+
+	if (old) {
+		dst_release(&old->u.dst);
+		rt_free(old);
+	}
+}
+
+/*
+ * Builds the forwarding route for @skb.  If it could be taken from or
+ * stored on the nexthop it is attached to @skb right away and *@result
+ * is left NULL, otherwise the new entry is returned for the cache.
+ */
 static int __mkroute_input(struct sk_buff *skb,
 			   struct fib_result *res,
 			   struct in_device *in_dev,
@@ -1992,6 +2063,7 @@ static int __mkroute_input(struct sk_buff *skb,
 	unsigned flags = 0;
 	__be32 spec_dst;
 	u32 itag;
+	bool nh_cache;
 
 	/* get a working reference to the output device */
 	out_dev = in_dev_get(FIB_RES_DEV(*res));
@@ -2036,6 +2108,17 @@ static int __mkroute_input(struct sk_buff *skb,
 		}
 	}
 
+	nh_cache = rt_nh_input_cacheable(skb, res, flags, itag);
+	if (nh_cache) {
+		rth = rt_nh_input_get(&FIB_RES_NH(*res), in_dev->dev->ifindex,
+				      flags);
+		if (rth) {
+			skb_dst_set(skb, &rth->u.dst);
+			*result = NULL;
+			err = 0;
+			goto cleanup;
+		}
+	}
 
 	rth = dst_alloc(&ipv4_dst_ops);
 	if (!rth) {
@@ -2073,6 +2156,12 @@ static int __mkroute_input(struct sk_buff *skb,
 
 	rth->rt_flags = flags;
 
+	if (nh_cache && !arp_bind_neighbour(&rth->u.dst)) {
+		rt_nh_input_set(&FIB_RES_NH(*res), rth);
+		skb_dst_set(skb, &rth->u.dst);
+		rth = NULL;
+	}
+
 	*result = rth;
 	err = 0;
  cleanup:
@@ -2098,7 +2187,7 @@ static int ip_mkroute_input(struct sk_buff *skb,
 
 	/* create a routing cache entry */
 	err = __mkroute_input(skb, res, in_dev, daddr, saddr, tos, &rth);
-	if (err)
+	if (err || !rth)
 		return err;
 
 	/* put it into the cache */
@@ -3144,6 +3233,25 @@ static int ipv4_sysctl_rt_secret_interval(ctl_table *ctl, int write,
 	return ret;
 }
 
+/* Entries cached before the switch must not keep being served */
+static int ipv4_sysctl_rt_cache_bypass(ctl_table *ctl, int write,
+				       void __user *buffer, size_t *lenp,
+				       loff_t *ppos)
+{
+	int old = ip_rt_cache_bypass;
+	int ret = proc_dointvec(ctl, write, buffer, lenp, ppos);
+	struct net *net;
+
+	if (write && !ret && !old != !ip_rt_cache_bypass) {
+		rtnl_lock();
+		for_each_net(net)
+			rt_cache_flush(net, 0);
+		rtnl_unlock();
+	}
+
+	return ret;
+}
+
 static ctl_table ipv4_route_table[] = {
 	{
 		.procname	= "gc_thresh",
@@ -3259,6 +3367,13 @@ static ctl_table ipv4_route_table[] = {
 		.mode		= 0644,
 		.proc_handler	= ipv4_sysctl_rt_secret_interval,
 	},
+	{
+		.procname	= "cache_bypass",
+		.data		= &ip_rt_cache_bypass,
+		.maxlen		= sizeof(int),
+		.mode		= 0644,
+		.proc_handler	= ipv4_sysctl_rt_cache_bypass,
+	},
 	{ }
 };
 
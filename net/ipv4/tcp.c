@@ -273,6 +273,8 @@
 #include <net/ip.h>
 #include <net/netdma.h>
 #include <net/sock.h>
+#include <net/busy_poll.h>
+#include <net/inet_common.h>
 
 #include <asm/uaccess.h>
 #include <asm/ioctls.h>
@@ -388,7 +390,7 @@ unsigned int tcp_poll(struct file *file, struct socket *sock, poll_table *wait)
 	 */
 
 	mask = 0;
-	if (sk->sk_err)
+	if (sk->sk_err || !skb_queue_empty(&sk->sk_error_queue))
 		mask = POLLERR;
 
 	/*
@@ -423,8 +425,9 @@ unsigned int tcp_poll(struct file *file, struct socket *sock, poll_table *wait)
 	if (sk->sk_shutdown & RCV_SHUTDOWN)
 		mask |= POLLIN | POLLRDNORM | POLLRDHUP;
 
-	/* Connected? */
-	if ((1 << sk->sk_state) & ~(TCPF_SYN_SENT | TCPF_SYN_RECV)) {
+	/* Connected?  A passive Fast Open socket is readable in SYN_RECV. */
+	if (sk->sk_state != TCP_SYN_SENT &&
+	    (sk->sk_state != TCP_SYN_RECV || tp->fastopen_rsk != NULL)) {
 		int target = sock_rcvlowat(sk, 0, INT_MAX);
 
 		if (tp->urg_seq == tp->copied_seq &&
@@ -438,7 +441,8 @@ unsigned int tcp_poll(struct file *file, struct socket *sock, poll_table *wait)
 		if (tp->rcv_nxt - tp->copied_seq >= target)
 			mask |= POLLIN | POLLRDNORM;
 
-		if (!(sk->sk_shutdown & SEND_SHUTDOWN)) {
+		if (sk->sk_state != TCP_SYN_RECV &&
+		    !(sk->sk_shutdown & SEND_SHUTDOWN)) {
 			if (sk_stream_wspace(sk) >= sk_stream_min_wspace(sk)) {
 				mask |= POLLOUT | POLLWRNORM;
 			} else {  /* send SIGIO later */
@@ -614,6 +618,8 @@ ssize_t tcp_splice_read(struct socket *sock, loff_t *ppos,
 	if (unlikely(*ppos))
 		return -ESPIPE;
 
+	sock_rps_record_flow(sk);
+
 	ret = spliced = 0;
 
 	lock_sock(sk);
@@ -897,22 +903,64 @@ static inline int select_size(struct sock *sk, int sg)
 	return tmp;
 }
 
+/*
+ * sendto(MSG_FASTOPEN) on an unconnected socket: connect and put as much
+ * of the data into the SYN as the cached cookie of the destination
+ * allows.  Returns the connect() error, *copied is what went into the SYN.
+ */
+static int tcp_sendmsg_fastopen(struct sock *sk, struct msghdr *msg,
+				int *copied, size_t size)
+{
+	struct tcp_sock *tp = tcp_sk(sk);
+	int err, flags;
+
+	if (!(sysctl_tcp_fastopen & TFO_CLIENT_ENABLE))
+		return -EOPNOTSUPP;
+	if (tp->fastopen_req != NULL)
+		return -EALREADY; /* Another Fast Open is in progress */
+
+	tp->fastopen_req = kzalloc(sizeof(struct tcp_fastopen_request),
+				   sk->sk_allocation);
+	if (unlikely(tp->fastopen_req == NULL))
+		return -ENOBUFS;
+	tp->fastopen_req->data = msg;
+	tp->fastopen_req->size = size;
+
+	flags = (msg->msg_flags & MSG_DONTWAIT) ? O_NONBLOCK : 0;
+	err = __inet_stream_connect(sk->sk_socket, msg->msg_name,
+				    msg->msg_namelen, flags);
+	*copied = tp->fastopen_req->copied;
+	kfree(tp->fastopen_req);
+	tp->fastopen_req = NULL;
+	return err;
+}
+
 int tcp_sendmsg(struct kiocb *iocb, struct socket *sock, struct msghdr *msg,
 		size_t size)
 {
 	struct sock *sk = sock->sk;
 	struct iovec *iov;
 	struct tcp_sock *tp = tcp_sk(sk);
+	struct ubuf_info *uarg = NULL;
 	struct sk_buff *skb;
 	int iovlen, flags;
 	int mss_now, size_goal;
-	int sg, err, copied;
+	int sg, zc = 0, err, copied = 0, copied_syn = 0, offset = 0;
 	long timeo;
 
 	lock_sock(sk);
 	TCP_CHECK_TIMER(sk);
 
 	flags = msg->msg_flags;
+	if (flags & MSG_FASTOPEN) {
+		err = tcp_sendmsg_fastopen(sk, msg, &copied_syn, size);
+		if (err == -EINPROGRESS && copied_syn > 0)
+			goto out;
+		else if (err)
+			goto out_err;
+		offset = copied_syn;
+	}
+
 	timeo = sock_sndtimeo(sk, flags & MSG_DONTWAIT);
 
 	/* Wait for a connection to finish. */
@@ -928,7 +976,6 @@ int tcp_sendmsg(struct kiocb *iocb, struct socket *sock, struct msghdr *msg,
 	/* Ok commence sending. */
 	iovlen = msg->msg_iovlen;
 	iov = msg->msg_iov;
-	copied = 0;
 
 	err = -EPIPE;
 	if (sk->sk_err || (sk->sk_shutdown & SEND_SHUTDOWN))
@@ -936,11 +983,35 @@ int tcp_sendmsg(struct kiocb *iocb, struct socket *sock, struct msghdr *msg,
 
 	sg = sk->sk_route_caps & NETIF_F_SG;
 
+	if ((flags & MSG_ZEROCOPY) && sock_flag(sk, SOCK_ZEROCOPY)) {
+		uarg = sock_zerocopy_alloc(sk);
+		if (!uarg) {
+			err = -ENOBUFS;
+			goto out_err;
+		}
+		/* Without SG and checksum offload the data is copied after
+		 * all, the completion still gets reported (as copied).
+		 */
+		zc = sg && (sk->sk_route_caps & NETIF_F_ALL_CSUM);
+		if (!zc)
+			uarg->zerocopy = 0;
+	}
+
 	while (--iovlen >= 0) {
 		int seglen = iov->iov_len;
 		unsigned char __user *from = iov->iov_base;
 
 		iov++;
+		/* Skip what already went out in the SYN */
+		if (unlikely(offset > 0)) {
+			if (offset >= seglen) {
+				offset -= seglen;
+				continue;
+			}
+			seglen -= offset;
+			from += offset;
+			offset = 0;
+		}
 
 		while (seglen > 0) {
 			int copy = 0;
@@ -982,6 +1053,12 @@ new_segment:
 			if (copy > seglen)
 				copy = seglen;
 
+			if (zc && skb->ip_summed != CHECKSUM_PARTIAL) {
+				/* Checksum offload went away under us */
+				uarg->zerocopy = 0;
+				zc = 0;
+			}
+
 			/* Where to copy to? */
 			if (skb_tailroom(skb) > 0) {
 				/* We have some space in skb head. Superb! */
@@ -989,6 +1066,48 @@ new_segment:
 					copy = skb_tailroom(skb);
 				if ((err = skb_add_data(skb, from, copy)) != 0)
 					goto do_fault;
+			} else if (zc) {
+				int i = skb_shinfo(skb)->nr_frags;
+				int off = (unsigned long)from & ~PAGE_MASK;
+				struct page *page;
+
+				/* Pin the user page itself. An skb can only
+				 * carry the pages of a single send.
+				 */
+				if (i == MAX_SKB_FRAGS ||
+				    (skb_zcopy(skb) && skb_zcopy(skb) != uarg)) {
+					tcp_mark_push(tp, skb);
+					goto new_segment;
+				}
+
+				if (copy > PAGE_SIZE - off)
+					copy = PAGE_SIZE - off;
+
+				if (!sk_wmem_schedule(sk, copy))
+					goto wait_for_memory;
+
+				if (get_user_pages_fast((unsigned long)from, 1,
+							0, &page) != 1) {
+					err = -EFAULT;
+					goto do_fault;
+				}
+
+				if (!skb_zcopy(skb))
+					skb_zcopy_set(skb, uarg);
+
+				if (skb_can_coalesce(skb, i, page, off)) {
+					skb_shinfo(skb)->frags[i - 1].size +=
+									copy;
+					put_page(page);
+				} else {
+					skb_fill_page_desc(skb, i, page, off, copy);
+				}
+
+				skb->len += copy;
+				skb->data_len += copy;
+				skb->truesize += copy;
+				sk->sk_wmem_queued += copy;
+				sk_mem_charge(sk, copy);
 			} else {
 				int merge = 0;
 				int i = skb_shinfo(skb)->nr_frags;
@@ -1098,9 +1217,15 @@ wait_for_memory:
 out:
 	if (copied)
 		tcp_push(sk, flags, mss_now, tp->nonagle);
+	if (uarg) {
+		if (copied)
+			sock_zerocopy_put(uarg);
+		else
+			sock_zerocopy_put_abort(uarg);
+	}
 	TCP_CHECK_TIMER(sk);
 	release_sock(sk);
-	return copied;
+	return copied + copied_syn;
 
 do_fault:
 	if (!skb->len) {
@@ -1113,9 +1238,11 @@ do_fault:
 	}
 
 do_error:
-	if (copied)
+	if (copied + copied_syn)
 		goto out;
 out_err:
+	if (uarg)
+		sock_zerocopy_put_abort(uarg);
 	err = sk_stream_error(sk, flags, err);
 	TCP_CHECK_TIMER(sk);
 	release_sock(sk);
@@ -1405,6 +1532,13 @@ int tcp_recvmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 	struct sk_buff *skb;
 	u32 urg_hole = 0;
 
+	if (unlikely(flags & MSG_ERRQUEUE))
+		return ip_recv_error(sk, msg, len);
+
+	if (sk_can_busy_loop(sk) && skb_queue_empty(&sk->sk_receive_queue) &&
+	    sk->sk_state == TCP_ESTABLISHED)
+		sk_busy_loop(sk, nonblock);
+
 	lock_sock(sk);
 
 	TCP_CHECK_TIMER(sk);
@@ -2354,6 +2488,15 @@ static int do_tcp_setsockopt(struct sock *sk, int level,
 						SOCK_MIN_RCVBUF / 2 : val;
 		break;
 
+	case TCP_FASTOPEN:
+		/* Maximum number of Fast Open children still in handshake */
+		if (val >= 0 && ((1 << sk->sk_state) &
+				 (TCPF_CLOSE | TCPF_LISTEN)))
+			tp->fastopen_qlen = val;
+		else
+			err = -EINVAL;
+		break;
+
 	case TCP_QUICKACK:
 		if (!val) {
 			icsk->icsk_ack.pingpong = 1;
@@ -3281,6 +3424,8 @@ void __init tcp_init(void)
 	tcp_secret_primary = &tcp_secret_one;
 	tcp_secret_retiring = &tcp_secret_two;
 	tcp_secret_secondary = &tcp_secret_two;
+
+	tcp_tasklet_init();
 }
 
 EXPORT_SYMBOL(tcp_close);
@@ -0,0 +1,124 @@
+/*
+ * TCP Fast Open: data in SYN, authorised by a cookie the server handed
+ * out on an earlier connection.
+ *
+ * The server cookie is a keyed hash of the client and server addresses,
+ * computed the same way as the syncookies, so nothing needs to be kept
+ * per client.  Clients remember the cookie (and the MSS) the server sent
+ * in a small table indexed by destination address.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/tcp.h>
+#include <linux/hash.h>
+#include <linux/random.h>
+#include <linux/cryptohash.h>
+#include <linux/kernel.h>
+#include <linux/spinlock.h>
+#include <net/tcp.h>
+
+int sysctl_tcp_fastopen __read_mostly;
+
+static u32 tcp_fastopen_secret[16 - 2 + SHA_DIGEST_WORDS];
+
+static __init int tcp_fastopen_init(void)
+{
+	get_random_bytes(tcp_fastopen_secret, sizeof(tcp_fastopen_secret));
+	return 0;
+}
+__initcall(tcp_fastopen_init);
+
+static DEFINE_PER_CPU(__u32 [16 + 5 + SHA_WORKSPACE_WORDS],
+		      tcp_fastopen_scratch);
+
+/* Called in softirq context, like the syncookie hash. */
+void tcp_fastopen_cookie_gen(__be32 saddr, __be32 daddr,
+			     struct tcp_fastopen_cookie *foc)
+{
+	__u32 *tmp = __get_cpu_var(tcp_fastopen_scratch);
+
+	memcpy(tmp + 2, tcp_fastopen_secret, sizeof(tcp_fastopen_secret));
+	tmp[0] = (__force u32)saddr;
+	tmp[1] = (__force u32)daddr;
+	sha_transform(tmp + 16, (__u8 *)tmp, tmp + 16 + 5);
+
+	foc->len = TCP_FASTOPEN_COOKIE_SIZE;
+	memcpy(foc->val, tmp + 16, TCP_FASTOPEN_COOKIE_SIZE);
+}
+
+/*
+ * Client side cookie cache.  It is direct mapped: a destination simply
+ * evicts whatever shared its slot, the worst outcome is one more SYN
+ * that asks for a cookie instead of carrying data.
+ */
+#define TCP_FASTOPEN_CACHE_BITS	8
+
+struct tcp_fastopen_cache {
+	struct net			*net;
+	__be32				daddr;
+	u16				mss;
+	struct tcp_fastopen_cookie	cookie;
+};
+
+static struct tcp_fastopen_cache
+	tcp_fastopen_cache[1 << TCP_FASTOPEN_CACHE_BITS];
+static DEFINE_SPINLOCK(tcp_fastopen_cache_lock);
+
+static inline struct tcp_fastopen_cache *tcp_fastopen_cache_slot(__be32 daddr)
+{
+	return &tcp_fastopen_cache[hash_32((__force u32)daddr,
+					   TCP_FASTOPEN_CACHE_BITS)];
+}
+
+/* Look up the cookie for the destination of a connecting socket.  Only
+ * IPv4 destinations are cached, other sockets send no option at all.
+ */
+void tcp_fastopen_cache_get(struct sock *sk, u16 *mss,
+			    struct tcp_fastopen_cookie *cookie)
+{
+	__be32 daddr = inet_sk(sk)->inet_daddr;
+	struct tcp_fastopen_cache *tfc;
+
+	*mss = 0;
+	if (sk->sk_family != AF_INET) {
+		cookie->len = -1;
+		return;
+	}
+
+	tfc = tcp_fastopen_cache_slot(daddr);
+	spin_lock_bh(&tcp_fastopen_cache_lock);
+	if (tfc->daddr == daddr && net_eq(tfc->net, sock_net(sk))) {
+		*mss = tfc->mss;
+		*cookie = tfc->cookie;
+	} else {
+		cookie->len = 0;
+	}
+	spin_unlock_bh(&tcp_fastopen_cache_lock);
+}
+
+void tcp_fastopen_cache_set(struct sock *sk, u16 mss,
+			    struct tcp_fastopen_cookie *cookie)
+{
+	__be32 daddr = inet_sk(sk)->inet_daddr;
+	struct tcp_fastopen_cache *tfc;
+
+	if (sk->sk_family != AF_INET)
+		return;
+
+	tfc = tcp_fastopen_cache_slot(daddr);
+	spin_lock_bh(&tcp_fastopen_cache_lock);
+	if (tfc->daddr != daddr || !net_eq(tfc->net, sock_net(sk))) {
+		tfc->net = sock_net(sk);
+		tfc->daddr = daddr;
+		tfc->cookie.len = 0;
+	}
+	if (mss)
+		tfc->mss = mss;
+	if (cookie->len > 0)
+		tfc->cookie = *cookie;
+	spin_unlock_bh(&tcp_fastopen_cache_lock);
+}
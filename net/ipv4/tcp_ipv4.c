@@ -72,6 +72,7 @@
 #include <net/timewait_sock.h>
 #include <net/xfrm.h>
 #include <net/netdma.h>
+#include <net/busy_poll.h>
 
 #include <linux/inet.h>
 #include <linux/ipv6.h>
@@ -743,6 +744,26 @@ static void tcp_v4_reqsk_send_ack(struct sock *sk, struct sk_buff *skb,
 			inet_rsk(req)->no_srccheck ? IP_REPLY_ARG_NOSRCCHECK : 0);
 }
 
+/* Checksum and send off a SYN-ACK built by tcp_make_synack(). */
+static int __tcp_v4_send_synack(struct sock *sk, struct sk_buff *skb,
+				const struct inet_request_sock *ireq,
+				struct ip_options *opt)
+{
+	struct tcphdr *th = tcp_hdr(skb);
+	int err;
+
+	th->check = tcp_v4_check(skb->len,
+				 ireq->loc_addr,
+				 ireq->rmt_addr,
+				 csum_partial(th, skb->len,
+					      skb->csum));
+
+	err = ip_build_and_send_pkt(skb, sk, ireq->loc_addr,
+				    ireq->rmt_addr,
+				    opt);
+	return net_xmit_eval(err);
+}
+
 /*
  *	Send a SYN-ACK after having received a SYN.
  *	This still operates on a request_sock only, not on a big
@@ -753,29 +774,36 @@ static int tcp_v4_send_synack(struct sock *sk, struct dst_entry *dst,
 			      struct request_values *rvp)
 {
 	const struct inet_request_sock *ireq = inet_rsk(req);
+	struct ip_options *opt = ireq->opt;
+	struct tcp_fastopen_cookie foc, *focp = NULL;
 	int err = -1;
 	struct sk_buff * skb;
 
+	/* A passive Fast Open child retransmitting its SYN-ACK has taken
+	 * the route and the IP options over from req.
+	 */
+	if (sk->sk_state != TCP_LISTEN) {
+		opt = inet_sk(sk)->opt;
+		if (!dst) {
+			dst = __sk_dst_check(sk, 0);
+			if (dst)
+				dst_hold(dst);
+		}
+	}
+
 	/* First, grab a route. */
 	if (!dst && (dst = inet_csk_route_req(sk, req)) == NULL)
 		return -1;
 
-	skb = tcp_make_synack(sk, dst, req, rvp);
-
-	if (skb) {
-		struct tcphdr *th = tcp_hdr(skb);
+	if (tcp_rsk(req)->fastopen_cookie_req) {
+		tcp_fastopen_cookie_gen(ireq->rmt_addr, ireq->loc_addr, &foc);
+		focp = &foc;
+	}
 
-		th->check = tcp_v4_check(skb->len,
-					 ireq->loc_addr,
-					 ireq->rmt_addr,
-					 csum_partial(th, skb->len,
-						      skb->csum));
+	skb = tcp_make_synack(sk, dst, req, rvp, focp);
 
-		err = ip_build_and_send_pkt(skb, sk, ireq->loc_addr,
-					    ireq->rmt_addr,
-					    ireq->opt);
-		err = net_xmit_eval(err);
-	}
+	if (skb)
+		err = __tcp_v4_send_synack(sk, skb, ireq, opt);
 
 	dst_release(dst);
 	return err;
@@ -1219,6 +1247,131 @@ static struct timewait_sock_ops tcp_timewait_sock_ops = {
 	.twsk_destructor= tcp_twsk_destructor,
 };
 
+/*
+ * Look at the Fast Open option of a SYN to a listener.  Returns true if
+ * the SYN carries data and a valid cookie, so that the connection can
+ * be handed to accept() right away.  A client asking for a cookie, or
+ * presenting a stale one, gets a fresh cookie in the SYN-ACK.
+ */
+static bool tcp_v4_fastopen_check(struct sock *sk, struct sk_buff *skb,
+				  struct request_sock *req,
+				  struct tcp_fastopen_cookie *foc)
+{
+	struct tcp_fastopen_cookie valid_foc;
+
+	if (foc->len < 0 || !tcp_sk(sk)->fastopen_qlen ||
+	    !(sysctl_tcp_fastopen & TFO_SERVER_ENABLE))
+		return false;
+
+	if (foc->len == 0) {
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENCOOKIEREQD);
+		tcp_rsk(req)->fastopen_cookie_req = 1;
+		return false;
+	}
+
+	tcp_fastopen_cookie_gen(ip_hdr(skb)->saddr, ip_hdr(skb)->daddr,
+				&valid_foc);
+	if (foc->len != valid_foc.len ||
+	    memcmp(foc->val, valid_foc.val, foc->len)) {
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVEFAIL);
+		tcp_rsk(req)->fastopen_cookie_req = 1;
+		return false;
+	}
+
+	/* A valid cookie is only worth a child socket if there is data */
+	if (TCP_SKB_CB(skb)->end_seq == TCP_SKB_CB(skb)->seq + 1 ||
+	    tcp_hdr(skb)->fin)
+		return false;
+
+	if (atomic_read(&tcp_sk(sk)->fastopen_pending) >=
+	    tcp_sk(sk)->fastopen_qlen) {
+		NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVEFAIL);
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Passive Fast Open: create the child socket at SYN time, queue the data
+ * of the SYN on it and hand it to accept() before the handshake is done.
+ * The child keeps the request sock to retransmit the SYN-ACK until the
+ * final ACK arrives, a separate one sits in the accept queue.
+ */
+static int tcp_v4_conn_req_fastopen(struct sock *sk, struct sk_buff *skb,
+				    struct request_sock *req,
+				    struct dst_entry *dst)
+{
+	struct tcp_request_sock *treq = tcp_rsk(req);
+	struct sk_buff *synack, *data = NULL;
+	struct request_sock *acc_req;
+	struct tcp_sock *tp;
+	struct sock *child;
+
+	acc_req = inet_reqsk_alloc(&tcp_request_sock_ops);
+	if (!acc_req)
+		goto drop;
+
+	if (!dst && (dst = inet_csk_route_req(sk, req)) == NULL)
+		goto drop_acc;
+
+	/* Build the SYN-ACK first, it sets up the window of the request. */
+	treq->syn_data_len = TCP_SKB_CB(skb)->end_seq -
+			     TCP_SKB_CB(skb)->seq - 1;
+	synack = tcp_make_synack(sk, dst, req, NULL, NULL);
+	if (!synack) {
+		dst_release(dst);
+		goto drop_acc;
+	}
+
+	/* syn_recv_sock() takes over the route, even on failure. */
+	child = inet_csk(sk)->icsk_af_ops->syn_recv_sock(sk, skb, req, dst);
+	if (!child) {
+		kfree_skb(synack);
+		goto drop_acc;
+	}
+	tp = tcp_sk(child);
+
+	if (treq->syn_data_len <= req->rcv_wnd &&
+	    sk_rmem_schedule(child, skb->truesize))
+		data = skb_clone(skb, GFP_ATOMIC);
+	if (data) {
+		skb_dst_drop(data);
+		__skb_pull(data, tcp_hdr(skb)->doff * 4);
+		skb_set_owner_r(data, child);
+		__skb_queue_tail(&child->sk_receive_queue, data);
+		tp->rcv_nxt = TCP_SKB_CB(skb)->end_seq;
+		tp->rcv_wup = tp->rcv_nxt;
+	} else {
+		/* Ack the SYN only, the client sends the data again. */
+		treq->syn_data_len = 0;
+		tcp_hdr(synack)->ack_seq = htonl(treq->rcv_isn + 1);
+	}
+
+	tp->fastopen_rsk = req;
+	req->retrans = 0;
+	sock_hold(sk);
+	treq->listener = sk;
+	atomic_inc(&tcp_sk(sk)->fastopen_pending);
+	__tcp_v4_send_synack(child, synack, inet_rsk(req),
+			     inet_sk(child)->opt);
+	inet_csk_reset_xmit_timer(child, ICSK_TIME_RETRANS,
+				  TCP_TIMEOUT_INIT, TCP_RTO_MAX);
+
+	inet_csk_reqsk_queue_add(sk, acc_req, child);
+	sk->sk_data_ready(sk, 0);
+
+	bh_unlock_sock(child);
+	sock_put(child);
+	NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVE);
+	return 0;
+
+drop_acc:
+	__reqsk_free(acc_req);
+drop:
+	NET_INC_STATS_BH(sock_net(sk), LINUX_MIB_TCPFASTOPENPASSIVEFAIL);
+	return -1;
+}
+
 int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 {
 	struct tcp_extend_values tmp_ext;
@@ -1236,6 +1389,7 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 #else
 #define want_cookie 0 /* Argh, why doesn't gcc optimize this :( */
 #endif
+	struct tcp_fastopen_cookie foc = { .len = -1 };
 
 	/* Never answer to SYNs send to broadcast or multicast */
 	if (skb_rtable(skb)->rt_flags & (RTCF_BROADCAST | RTCF_MULTICAST))
@@ -1273,7 +1427,7 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	tcp_clear_options(&tmp_opt);
 	tmp_opt.mss_clamp = TCP_MSS_DEFAULT;
 	tmp_opt.user_mss  = tp->rx_opt.user_mss;
-	tcp_parse_options(skb, &tmp_opt, &hash_location, 0);
+	tcp_parse_options(skb, &tmp_opt, &hash_location, 0, &foc);
 
 	if (tmp_opt.cookie_plus > 0 &&
 	    tmp_opt.saw_tstamp &&
@@ -1381,6 +1535,12 @@ int tcp_v4_conn_request(struct sock *sk, struct sk_buff *skb)
 	}
 	tcp_rsk(req)->snt_isn = isn;
 
+	if (!want_cookie && tcp_v4_fastopen_check(sk, skb, req, &foc)) {
+		if (tcp_v4_conn_req_fastopen(sk, skb, req, dst))
+			goto drop_and_free;
+		return 0;
+	}
+
 	if (tcp_v4_send_synack(sk, dst, req,
 			       (struct request_values *)&tmp_ext) ||
 	    want_cookie)
@@ -1558,6 +1718,7 @@ int tcp_v4_do_rcv(struct sock *sk, struct sk_buff *skb)
 #endif
 
 	if (sk->sk_state == TCP_ESTABLISHED) { /* Fast path */
+		sock_rps_save_rxhash(sk, skb->rxhash);
 		TCP_CHECK_TIMER(sk);
 		if (tcp_rcv_established(sk, skb, tcp_hdr(skb), skb->len)) {
 			rsk = sk;
@@ -1673,6 +1834,7 @@ process:
 	if (sk_filter(sk, skb))
 		goto discard_and_relse;
 
+	sk_mark_napi_id(sk, skb);
 	skb->dev = NULL;
 
 	bh_lock_sock_nested(sk);
@@ -1736,6 +1898,7 @@ do_time_wait:
 	case TCP_TW_SYN: {
 		struct sock *sk2 = inet_lookup_listener(dev_net(skb->dev),
 							&tcp_hashinfo,
+							iph->saddr, th->source,
 							iph->daddr, th->dest,
 							inet_iif(skb));
 		if (sk2) {
@@ -1853,6 +2016,7 @@ static int tcp_v4_init_sock(struct sock *sk)
 	skb_queue_head_init(&tp->out_of_order_queue);
 	tcp_init_xmit_timers(sk);
 	tcp_prequeue_init(tp);
+	INIT_LIST_HEAD(&tp->tsq_node);
 
 	icsk->icsk_rto = TCP_TIMEOUT_INIT;
 	tp->mdev = TCP_TIMEOUT_INIT;
@@ -1958,6 +2122,10 @@ void tcp_v4_destroy_sock(struct sock *sk)
 		tp->cookie_values = NULL;
 	}
 
+	/* Passive Fast Open child that never completed its handshake */
+	if (tp->fastopen_rsk != NULL)
+		tcp_fastopen_rsk_free(sk);
+
 	percpu_counter_dec(&tcp_sockets_allocated);
 }
 
@@ -2517,6 +2685,7 @@ struct proto tcp_prot = {
 	.getsockopt		= tcp_getsockopt,
 	.recvmsg		= tcp_recvmsg,
 	.backlog_rcv		= tcp_v4_do_rcv,
+	.release_cb		= tcp_release_cb,
 	.hash			= inet_hash,
 	.unhash			= inet_unhash,
 	.get_port		= inet_csk_get_port,
@@ -103,25 +103,40 @@ void ip_vs_init_hash_table(struct list_head *table, int rows)
 		INIT_LIST_HEAD(&table[rows]);
 }
 
+/*
+ *	The packet path only ever touches this cpu's counters, see
+ *	ip_vs_read_stats() for the readers.
+ */
+static inline void
+ip_vs_stats_add_in(struct ip_vs_stats *stats, unsigned int len)
+{
+	struct ip_vs_cpu_stats *s = this_cpu_ptr(stats->cpustats);
+
+	ip_vs_cpu_stats_update_begin(s);
+	s->inpkts++;
+	s->inbytes += len;
+	ip_vs_cpu_stats_update_end(s);
+}
+
+static inline void
+ip_vs_stats_add_out(struct ip_vs_stats *stats, unsigned int len)
+{
+	struct ip_vs_cpu_stats *s = this_cpu_ptr(stats->cpustats);
+
+	ip_vs_cpu_stats_update_begin(s);
+	s->outpkts++;
+	s->outbytes += len;
+	ip_vs_cpu_stats_update_end(s);
+}
+
 static inline void
 ip_vs_in_stats(struct ip_vs_conn *cp, struct sk_buff *skb)
 {
 	struct ip_vs_dest *dest = cp->dest;
 	if (dest && (dest->flags & IP_VS_DEST_F_AVAILABLE)) {
-		spin_lock(&dest->stats.lock);
-		dest->stats.ustats.inpkts++;
-		dest->stats.ustats.inbytes += skb->len;
-		spin_unlock(&dest->stats.lock);
-
-		spin_lock(&dest->svc->stats.lock);
-		dest->svc->stats.ustats.inpkts++;
-		dest->svc->stats.ustats.inbytes += skb->len;
-		spin_unlock(&dest->svc->stats.lock);
-
-		spin_lock(&ip_vs_stats.lock);
-		ip_vs_stats.ustats.inpkts++;
-		ip_vs_stats.ustats.inbytes += skb->len;
-		spin_unlock(&ip_vs_stats.lock);
+		ip_vs_stats_add_in(&dest->stats, skb->len);
+		ip_vs_stats_add_in(&dest->svc->stats, skb->len);
+		ip_vs_stats_add_in(&ip_vs_stats, skb->len);
 	}
 }
 
@@ -131,20 +146,9 @@ ip_vs_out_stats(struct ip_vs_conn *cp, struct sk_buff *skb)
 {
 	struct ip_vs_dest *dest = cp->dest;
 	if (dest && (dest->flags & IP_VS_DEST_F_AVAILABLE)) {
-		spin_lock(&dest->stats.lock);
-		dest->stats.ustats.outpkts++;
-		dest->stats.ustats.outbytes += skb->len;
-		spin_unlock(&dest->stats.lock);
-
-		spin_lock(&dest->svc->stats.lock);
-		dest->svc->stats.ustats.outpkts++;
-		dest->svc->stats.ustats.outbytes += skb->len;
-		spin_unlock(&dest->svc->stats.lock);
-
-		spin_lock(&ip_vs_stats.lock);
-		ip_vs_stats.ustats.outpkts++;
-		ip_vs_stats.ustats.outbytes += skb->len;
-		spin_unlock(&ip_vs_stats.lock);
+		ip_vs_stats_add_out(&dest->stats, skb->len);
+		ip_vs_stats_add_out(&dest->svc->stats, skb->len);
+		ip_vs_stats_add_out(&ip_vs_stats, skb->len);
 	}
 }
 
@@ -152,17 +156,9 @@ ip_vs_out_stats(struct ip_vs_conn *cp, struct sk_buff *skb)
 static inline void
 ip_vs_conn_stats(struct ip_vs_conn *cp, struct ip_vs_service *svc)
 {
-	spin_lock(&cp->dest->stats.lock);
-	cp->dest->stats.ustats.conns++;
-	spin_unlock(&cp->dest->stats.lock);
-
-	spin_lock(&svc->stats.lock);
-	svc->stats.ustats.conns++;
-	spin_unlock(&svc->stats.lock);
-
-	spin_lock(&ip_vs_stats.lock);
-	ip_vs_stats.ustats.conns++;
-	spin_unlock(&ip_vs_stats.lock);
+	this_cpu_ptr(cp->dest->stats.cpustats)->conns++;
+	this_cpu_ptr(svc->stats.cpustats)->conns++;
+	this_cpu_ptr(ip_vs_stats.cpustats)->conns++;
 }
 
 
@@ -506,6 +506,18 @@ __ip_vs_bind_svc(struct ip_vs_dest *dest, struct ip_vs_service *svc)
 	dest->svc = svc;
 }
 
+static void ip_vs_service_free(struct ip_vs_service *svc)
+{
+	free_percpu(svc->stats.cpustats);
+	kfree(svc);
+}
+
+static void ip_vs_dest_free(struct ip_vs_dest *dest)
+{
+	free_percpu(dest->stats.cpustats);
+	kfree(dest);
+}
+
 static inline void
 __ip_vs_unbind_svc(struct ip_vs_dest *dest)
 {
@@ -513,7 +525,7 @@ __ip_vs_unbind_svc(struct ip_vs_dest *dest)
 
 	dest->svc = NULL;
 	if (atomic_dec_and_test(&svc->refcnt))
-		kfree(svc);
+		ip_vs_service_free(svc);
 }
 
 
@@ -713,7 +725,7 @@ ip_vs_trash_get_dest(struct ip_vs_service *svc, const union nf_inet_addr *daddr,
 			list_del(&dest->n_list);
 			ip_vs_dst_reset(dest);
 			__ip_vs_unbind_svc(dest);
-			kfree(dest);
+			ip_vs_dest_free(dest);
 		}
 	}
 
@@ -738,7 +750,7 @@ static void ip_vs_trash_cleanup(void)
 		list_del(&dest->n_list);
 		ip_vs_dst_reset(dest);
 		__ip_vs_unbind_svc(dest);
-		kfree(dest);
+		ip_vs_dest_free(dest);
 	}
 }
 
@@ -748,6 +760,8 @@ ip_vs_zero_stats(struct ip_vs_stats *stats)
 {
 	spin_lock_bh(&stats->lock);
 
+	/* The per-cpu counters keep running, the estimator remembers
+	 * where they were. */
 	memset(&stats->ustats, 0, sizeof(stats->ustats));
 	ip_vs_zero_estimator(stats);
 
@@ -848,6 +862,12 @@ ip_vs_new_dest(struct ip_vs_service *svc, struct ip_vs_dest_user_kern *udest,
 		pr_err("%s(): no memory.\n", __func__);
 		return -ENOMEM;
 	}
+	dest->stats.cpustats = alloc_percpu(struct ip_vs_cpu_stats);
+	if (!dest->stats.cpustats) {
+		pr_err("%s(): no memory.\n", __func__);
+		kfree(dest);
+		return -ENOMEM;
+	}
 
 	dest->af = svc->af;
 	dest->protocol = svc->protocol;
@@ -1069,7 +1089,7 @@ static void __ip_vs_del_dest(struct ip_vs_dest *dest)
 		   and only one user context can update virtual service at a
 		   time, so the operation here is OK */
 		atomic_dec(&dest->svc->refcnt);
-		kfree(dest);
+		ip_vs_dest_free(dest);
 	} else {
 		IP_VS_DBG_BUF(3, "Moving dest %s:%u into trash, "
 			      "dest->refcnt=%d\n",
@@ -1183,6 +1203,12 @@ ip_vs_add_service(struct ip_vs_service_user_kern *u,
 		ret = -ENOMEM;
 		goto out_err;
 	}
+	svc->stats.cpustats = alloc_percpu(struct ip_vs_cpu_stats);
+	if (!svc->stats.cpustats) {
+		IP_VS_DBG(1, "%s(): no memory\n", __func__);
+		ret = -ENOMEM;
+		goto out_err;
+	}
 
 	/* I'm the first user of the service */
 	atomic_set(&svc->usecnt, 1);
@@ -1236,7 +1262,7 @@ ip_vs_add_service(struct ip_vs_service_user_kern *u,
 			ip_vs_app_inc_put(svc->inc);
 			local_bh_enable();
 		}
-		kfree(svc);
+		ip_vs_service_free(svc);
 	}
 	ip_vs_scheduler_put(sched);
 
@@ -1379,7 +1405,7 @@ static void __ip_vs_del_service(struct ip_vs_service *svc)
 	 *    Free the service if nobody refers to it
 	 */
 	if (atomic_read(&svc->refcnt) == 0)
-		kfree(svc);
+		ip_vs_service_free(svc);
 
 	/* decrease the module use count */
 	ip_vs_use_count_dec();
@@ -1948,6 +1974,7 @@ static int ip_vs_stats_show(struct seq_file *seq, void *v)
 		   "   Conns  Packets  Packets            Bytes            Bytes\n");
 
 	spin_lock_bh(&ip_vs_stats.lock);
+	ip_vs_read_stats(&ip_vs_stats);
 	seq_printf(seq, "%8X %8X %8X %16LX %16LX\n\n", ip_vs_stats.ustats.conns,
 		   ip_vs_stats.ustats.inpkts, ip_vs_stats.ustats.outpkts,
 		   (unsigned long long) ip_vs_stats.ustats.inbytes,
@@ -2204,6 +2231,7 @@ static void
 ip_vs_copy_stats(struct ip_vs_stats_user *dst, struct ip_vs_stats *src)
 {
 	spin_lock_bh(&src->lock);
+	ip_vs_read_stats(src);
 	memcpy(dst, &src->ustats, sizeof(*dst));
 	spin_unlock_bh(&src->lock);
 }
@@ -2587,6 +2615,7 @@ static int ip_vs_genl_fill_stats(struct sk_buff *skb, int container_type,
 		return -EMSGSIZE;
 
 	spin_lock_bh(&stats->lock);
+	ip_vs_read_stats(stats);
 
 	NLA_PUT_U32(skb, IPVS_STATS_ATTR_CONNS, stats->ustats.conns);
 	NLA_PUT_U32(skb, IPVS_STATS_ATTR_INPKTS, stats->ustats.inpkts);
@@ -3383,9 +3412,16 @@ int __init ip_vs_control_init(void)
 
 	EnterFunction(2);
 
+	ip_vs_stats.cpustats = alloc_percpu(struct ip_vs_cpu_stats);
+	if (!ip_vs_stats.cpustats) {
+		pr_err("cannot allocate statistics.\n");
+		return -ENOMEM;
+	}
+
 	ret = nf_register_sockopt(&ip_vs_sockopts);
 	if (ret) {
 		pr_err("cannot register sockopt.\n");
+		free_percpu(ip_vs_stats.cpustats);
 		return ret;
 	}
 
@@ -3393,6 +3429,7 @@ int __init ip_vs_control_init(void)
 	if (ret) {
 		pr_err("cannot register Generic Netlink interface.\n");
 		nf_unregister_sockopt(&ip_vs_sockopts);
+		free_percpu(ip_vs_stats.cpustats);
 		return ret;
 	}
 
@@ -3432,5 +3469,6 @@ void ip_vs_control_cleanup(void)
 	proc_net_remove(&init_net, "ip_vs");
 	ip_vs_genl_unregister();
 	nf_unregister_sockopt(&ip_vs_sockopts);
+	free_percpu(ip_vs_stats.cpustats);
 	LeaveFunction(2);
 }
@@ -21,6 +21,7 @@
 #include <linux/interrupt.h>
 #include <linux/sysctl.h>
 #include <linux/list.h>
+#include <linux/percpu.h>
 
 #include <net/ip_vs.h>
 
@@ -45,6 +46,11 @@
     rate is ~2.15Gbits/s, average pps and cps are scaled by 2^10.
 
   * A lot code is taken from net/sched/estimator.c
+
+  * The packet path only updates per-cpu counters, they are added up
+    here every 2 seconds and whenever user space reads the statistics.
+    The estimator works on the raw sums, zeroing only moves the base
+    that is subtracted from what user space sees.
  */
 
 
@@ -54,10 +60,53 @@ static LIST_HEAD(est_list);
 static DEFINE_SPINLOCK(est_lock);
 static DEFINE_TIMER(est_timer, estimation_timer, 0, 0);
 
+static void ip_vs_sum_cpu_stats(struct ip_vs_cpu_stats *sum,
+				struct ip_vs_stats *stats)
+{
+	int i;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(i) {
+		struct ip_vs_cpu_stats *s = per_cpu_ptr(stats->cpustats, i);
+		u64 inbytes, outbytes;
+		u32 conns, inpkts, outpkts;
+		unsigned start;
+
+		do {
+			start = ip_vs_cpu_stats_fetch_begin(s);
+			conns = s->conns;
+			inpkts = s->inpkts;
+			outpkts = s->outpkts;
+			inbytes = s->inbytes;
+			outbytes = s->outbytes;
+		} while (ip_vs_cpu_stats_fetch_retry(s, start));
+
+		sum->conns += conns;
+		sum->inpkts += inpkts;
+		sum->outpkts += outpkts;
+		sum->inbytes += inbytes;
+		sum->outbytes += outbytes;
+	}
+}
+
+/* Fold the per-cpu counters into ustats, caller must hold stats->lock */
+void ip_vs_read_stats(struct ip_vs_stats *stats)
+{
+	struct ip_vs_cpu_stats sum;
+
+	ip_vs_sum_cpu_stats(&sum, stats);
+	stats->ustats.conns = sum.conns - stats->base.conns;
+	stats->ustats.inpkts = sum.inpkts - stats->base.inpkts;
+	stats->ustats.outpkts = sum.outpkts - stats->base.outpkts;
+	stats->ustats.inbytes = sum.inbytes - stats->base.inbytes;
+	stats->ustats.outbytes = sum.outbytes - stats->base.outbytes;
+}
+
 static void estimation_timer(unsigned long arg)
 {
 	struct ip_vs_estimator *e;
 	struct ip_vs_stats *s;
+	struct ip_vs_cpu_stats sum;
 	u32 n_conns;
 	u32 n_inpkts, n_outpkts;
 	u64 n_inbytes, n_outbytes;
@@ -67,12 +116,15 @@ static void estimation_timer(unsigned long arg)
 	list_for_each_entry(e, &est_list, list) {
 		s = container_of(e, struct ip_vs_stats, est);
 
+		/* No lock needed to add up the per-cpu counters */
+		ip_vs_sum_cpu_stats(&sum, s);
+		n_conns = sum.conns;
+		n_inpkts = sum.inpkts;
+		n_outpkts = sum.outpkts;
+		n_inbytes = sum.inbytes;
+		n_outbytes = sum.outbytes;
+
 		spin_lock(&s->lock);
-		n_conns = s->ustats.conns;
-		n_inpkts = s->ustats.inpkts;
-		n_outpkts = s->ustats.outpkts;
-		n_inbytes = s->ustats.inbytes;
-		n_outbytes = s->ustats.outbytes;
 
 		/* scaled by 2^10, but divided 2 seconds */
 		rate = (n_conns - e->last_conns)<<9;
@@ -108,22 +160,25 @@ static void estimation_timer(unsigned long arg)
 void ip_vs_new_estimator(struct ip_vs_stats *stats)
 {
 	struct ip_vs_estimator *est = &stats->est;
+	struct ip_vs_cpu_stats sum;
 
 	INIT_LIST_HEAD(&est->list);
 
-	est->last_conns = stats->ustats.conns;
+	ip_vs_sum_cpu_stats(&sum, stats);
+
+	est->last_conns = sum.conns;
 	est->cps = stats->ustats.cps<<10;
 
-	est->last_inpkts = stats->ustats.inpkts;
+	est->last_inpkts = sum.inpkts;
 	est->inpps = stats->ustats.inpps<<10;
 
-	est->last_outpkts = stats->ustats.outpkts;
+	est->last_outpkts = sum.outpkts;
 	est->outpps = stats->ustats.outpps<<10;
 
-	est->last_inbytes = stats->ustats.inbytes;
+	est->last_inbytes = sum.inbytes;
 	est->inbps = stats->ustats.inbps<<5;
 
-	est->last_outbytes = stats->ustats.outbytes;
+	est->last_outbytes = sum.outbytes;
 	est->outbps = stats->ustats.outbps<<5;
 
 	spin_lock_bh(&est_lock);
@@ -143,13 +198,16 @@ void ip_vs_kill_estimator(struct ip_vs_stats *stats)
 void ip_vs_zero_estimator(struct ip_vs_stats *stats)
 {
 	struct ip_vs_estimator *est = &stats->est;
+	struct ip_vs_cpu_stats sum;
 
 	/* set counters zero, caller must hold the stats->lock lock */
-	est->last_inbytes = 0;
-	est->last_outbytes = 0;
-	est->last_conns = 0;
-	est->last_inpkts = 0;
-	est->last_outpkts = 0;
+	ip_vs_sum_cpu_stats(&sum, stats);
+	stats->base = sum;
+	est->last_inbytes = sum.inbytes;
+	est->last_outbytes = sum.outbytes;
+	est->last_conns = sum.conns;
+	est->last_inpkts = sum.inpkts;
+	est->last_outpkts = sum.outpkts;
 	est->cps = 0;
 	est->inpps = 0;
 	est->outpps = 0;
@@ -662,6 +662,10 @@ void xt_free_table_info(struct xt_table_info *info)
 		else
 			vfree(info->entries[cpu]);
 	}
+	if (is_vmalloc_addr(info->runs))
+		vfree(info->runs);
+	else
+		kfree(info->runs);
 	kfree(info);
 }
 EXPORT_SYMBOL(xt_free_table_info);
@@ -158,9 +158,36 @@ struct packet_mreq_max {
 	unsigned char	mr_address[MAX_ADDR_LEN];
 };
 
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
+static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		int closing, int tx_ring);
 
+#define DEFAULT_PRB_RETIRE_TOV	(8)	/* 8 ms */
+
+/* kbdq - kernel block descriptor queue, the TPACKET_V3 receive ring */
+struct tpacket_kbdq_core {
+	unsigned int		knum_blocks;
+	unsigned int		kblk_size;
+	unsigned int		blk_sizeof_priv;
+	unsigned int		max_frame_len;
+	unsigned int		feature_req_word;
+
+	/* block we fill; not opened yet while the queue is frozen */
+	unsigned int		kactive_blk_num;
+	unsigned int		last_kactive_blk_num;
+	unsigned int		frozen:1,
+				delete_blk_timer:1;
+
+	char			*nxt_offset;
+	char			*prev;
+	u64			knxt_seq_num;
+
+	/* frames reserved in the active block but still being copied */
+	atomic_t		blk_fill_in_prog;
+
+	unsigned long		tov_in_jiffies;
+	struct timer_list	retire_blk_timer;
+};
+
 struct packet_ring_buffer {
 	char			**pg_vec;
 	unsigned int		head;
@@ -172,6 +199,7 @@ struct packet_ring_buffer {
 	unsigned int		pg_vec_pages;
 	unsigned int		pg_vec_len;
 
+	struct tpacket_kbdq_core	prb_bdqc;
 	atomic_t		pending;
 };
 
@@ -180,10 +208,32 @@ static int tpacket_snd(struct packet_sock *po, struct msghdr *msg);
 
 static void packet_flush_mclist(struct sock *sk);
 
+#define PACKET_FANOUT_MAX	256
+
+/*
+ * A fanout group owns the single protocol hook of all its members and
+ * hands each packet to one of them, picked by flow hash, round robin or
+ * receiving CPU.
+ */
+struct packet_fanout {
+#ifdef CONFIG_NET_NS
+	struct net		*net;
+#endif
+	unsigned int		num_members;
+	u16			id;
+	u8			type;
+	atomic_t		rr_cur;
+	struct list_head	list;
+	struct sock		*arr[PACKET_FANOUT_MAX];
+	spinlock_t		lock;
+	atomic_t		sk_ref;
+	struct packet_type	prot_hook ____cacheline_aligned_in_smp;
+};
+
 struct packet_sock {
 	/* struct sock has to be the first member of packet_sock */
 	struct sock		sk;
-	struct tpacket_stats	stats;
+	struct tpacket_stats_v3	stats;
 	struct packet_ring_buffer	rx_ring;
 	struct packet_ring_buffer	tx_ring;
 	int			copy_thresh;
@@ -201,6 +251,7 @@ struct packet_sock {
 	unsigned int		tp_hdrlen;
 	unsigned int		tp_reserve;
 	unsigned int		tp_loss:1;
+	struct packet_fanout	*fanout;
 	struct packet_type	prot_hook ____cacheline_aligned_in_smp;
 };
 
@@ -313,6 +364,287 @@ static inline struct packet_sock *pkt_sk(struct sock *sk)
 	return (struct packet_sock *)sk;
 }
 
+#define BLK_HDR_LEN		TPACKET_ALIGN(sizeof(struct tpacket_block_desc))
+#define BLK_PLUS_PRIV(sz_of_priv) \
+	(BLK_HDR_LEN + TPACKET_ALIGN((sz_of_priv)))
+
+#define GET_PBDQC_FROM_RB(x)	((struct tpacket_kbdq_core *)(&(x)->prb_bdqc))
+
+static inline struct tpacket_hdr_v1 *prb_block_hdr(struct packet_ring_buffer *rb,
+						   unsigned int blk)
+{
+	return &((struct tpacket_block_desc *)rb->pg_vec[blk])->hdr.bh1;
+}
+
+static int prb_block_status(struct packet_ring_buffer *rb, unsigned int blk)
+{
+	struct tpacket_hdr_v1 *h1 = prb_block_hdr(rb, blk);
+
+	smp_rmb();
+	flush_dcache_page(virt_to_page(&h1->block_status));
+	return h1->block_status;
+}
+
+/* Called with the receive queue lock held, the active block is kernel owned */
+static void prb_open_block(struct packet_ring_buffer *rb)
+{
+	struct tpacket_kbdq_core *pkc = GET_PBDQC_FROM_RB(rb);
+	struct tpacket_hdr_v1 *h1 = prb_block_hdr(rb, pkc->kactive_blk_num);
+	struct timespec ts;
+
+	getnstimeofday(&ts);
+
+	h1->num_pkts = 0;
+	h1->offset_to_first_pkt = BLK_PLUS_PRIV(pkc->blk_sizeof_priv);
+	h1->blk_len = h1->offset_to_first_pkt;
+	h1->seq_num = pkc->knxt_seq_num++;
+	h1->ts_first_pkt.ts_sec = ts.tv_sec;
+	h1->ts_first_pkt.ts_nsec = ts.tv_nsec;
+	h1->ts_last_pkt.ts_sec = ts.tv_sec;
+	h1->ts_last_pkt.ts_nsec = ts.tv_nsec;
+
+	pkc->nxt_offset = rb->pg_vec[pkc->kactive_blk_num] +
+			  h1->offset_to_first_pkt;
+	pkc->prev = NULL;
+	pkc->frozen = 0;
+}
+
+/*
+ * Hand the active block over to user space and move on to the next one.
+ * If user space has not returned that one yet the queue freezes, and
+ * packets are dropped until it does.
+ */
+static void prb_retire_current_block(struct packet_sock *po, int status)
+{
+	struct packet_ring_buffer *rb = &po->rx_ring;
+	struct tpacket_kbdq_core *pkc = GET_PBDQC_FROM_RB(rb);
+	struct tpacket_hdr_v1 *h1 = prb_block_hdr(rb, pkc->kactive_blk_num);
+	char *blk = rb->pg_vec[pkc->kactive_blk_num];
+	struct page *p_start, *p_end;
+
+	/* Let other CPUs finish copying into their reserved frames */
+	while (atomic_read(&pkc->blk_fill_in_prog))
+		cpu_relax();
+
+	if (pkc->prev) {
+		struct tpacket3_hdr *last = (struct tpacket3_hdr *)pkc->prev;
+
+		h1->ts_last_pkt.ts_sec = last->tp_sec;
+		h1->ts_last_pkt.ts_nsec = last->tp_nsec;
+	} else {
+		struct timespec ts;
+
+		getnstimeofday(&ts);
+		h1->ts_last_pkt.ts_sec = ts.tv_sec;
+		h1->ts_last_pkt.ts_nsec = ts.tv_nsec;
+	}
+
+	p_start = virt_to_page(blk);
+	p_end = virt_to_page(blk + h1->blk_len - 1);
+	while (p_start <= p_end) {
+		flush_dcache_page(p_start);
+		p_start++;
+	}
+
+	smp_wmb();
+	h1->block_status = TP_STATUS_USER | status;
+	flush_dcache_page(virt_to_page(&h1->block_status));
+	smp_wmb();
+
+	po->sk.sk_data_ready(&po->sk, 0);
+
+	pkc->kactive_blk_num++;
+	if (pkc->kactive_blk_num == pkc->knum_blocks)
+		pkc->kactive_blk_num = 0;
+
+	if (prb_block_status(rb, pkc->kactive_blk_num) != TP_STATUS_KERNEL) {
+		pkc->frozen = 1;
+		po->stats.tp_freeze_q_cnt++;
+		return;
+	}
+	prb_open_block(rb);
+}
+
+/* Thaw the queue if user space handed back the block it stopped on */
+static bool prb_active_block_ready(struct packet_ring_buffer *rb)
+{
+	struct tpacket_kbdq_core *pkc = GET_PBDQC_FROM_RB(rb);
+
+	if (likely(!pkc->frozen))
+		return true;
+	if (prb_block_status(rb, pkc->kactive_blk_num) != TP_STATUS_KERNEL)
+		return false;
+	prb_open_block(rb);
+	return true;
+}
+
+/*
+ * Reserve len bytes for a frame in the active block, retiring it first
+ * if the frame does not fit.  Returns NULL if the frame cannot be placed.
+ * Called with the receive queue lock held; the caller drops
+ * prb_bdqc.blk_fill_in_prog once the frame is written.
+ */
+static void *prb_lookup_frame_in_block(struct packet_sock *po,
+				       unsigned int len)
+{
+	struct packet_ring_buffer *rb = &po->rx_ring;
+	struct tpacket_kbdq_core *pkc = GET_PBDQC_FROM_RB(rb);
+	struct tpacket_hdr_v1 *h1;
+	struct tpacket3_hdr *ppd;
+	char *curr, *end;
+
+	if (!prb_active_block_ready(rb))
+		return NULL;
+
+	len = TPACKET_ALIGN(len);
+	if (unlikely(len > pkc->max_frame_len))
+		return NULL;
+	curr = pkc->nxt_offset;
+	end = rb->pg_vec[pkc->kactive_blk_num] + pkc->kblk_size;
+	if (curr + len > end) {
+		prb_retire_current_block(po, 0);
+		if (pkc->frozen)
+			return NULL;
+		curr = pkc->nxt_offset;
+		end = rb->pg_vec[pkc->kactive_blk_num] + pkc->kblk_size;
+		if (unlikely(curr + len > end))
+			return NULL;
+	}
+
+	h1 = prb_block_hdr(rb, pkc->kactive_blk_num);
+	ppd = (struct tpacket3_hdr *)curr;
+	ppd->tp_next_offset = 0;
+	if (pkc->prev)
+		((struct tpacket3_hdr *)pkc->prev)->tp_next_offset =
+			curr - pkc->prev;
+	pkc->prev = curr;
+	pkc->nxt_offset = curr + len;
+	h1->blk_len += len;
+	h1->num_pkts++;
+	atomic_inc(&pkc->blk_fill_in_prog);
+
+	return curr;
+}
+
+/*
+ * Retire the active block if it has held packets for a whole timeout
+ * without filling up, so that a slow trickle still reaches user space.
+ */
+static void prb_retire_rx_blk_timer_expired(unsigned long data)
+{
+	struct packet_sock *po = (struct packet_sock *)data;
+	struct packet_ring_buffer *rb = &po->rx_ring;
+	struct tpacket_kbdq_core *pkc = GET_PBDQC_FROM_RB(rb);
+
+	spin_lock(&po->sk.sk_receive_queue.lock);
+	if (unlikely(pkc->delete_blk_timer))
+		goto out;
+
+	if (prb_active_block_ready(rb) &&
+	    pkc->kactive_blk_num == pkc->last_kactive_blk_num &&
+	    prb_block_hdr(rb, pkc->kactive_blk_num)->num_pkts)
+		prb_retire_current_block(po, TP_STATUS_BLK_TMO);
+
+	pkc->last_kactive_blk_num = pkc->kactive_blk_num;
+	mod_timer(&pkc->retire_blk_timer, jiffies + pkc->tov_in_jiffies);
+out:
+	spin_unlock(&po->sk.sk_receive_queue.lock);
+}
+
+static void prb_shutdown_retire_blk_timer(struct packet_sock *po,
+					  struct sk_buff_head *rb_queue)
+{
+	struct tpacket_kbdq_core *pkc = GET_PBDQC_FROM_RB(&po->rx_ring);
+
+	spin_lock_bh(&rb_queue->lock);
+	pkc->delete_blk_timer = 1;
+	spin_unlock_bh(&rb_queue->lock);
+
+	del_timer_sync(&pkc->retire_blk_timer);
+}
+
+/* Called with the socket detached from the network, once rb->pg_vec is set */
+static void init_prb_bdqc(struct packet_sock *po, struct packet_ring_buffer *rb,
+			  struct tpacket_req3 *req3)
+{
+	struct tpacket_kbdq_core *pkc = GET_PBDQC_FROM_RB(rb);
+	unsigned int i;
+
+	memset(pkc, 0, sizeof(*pkc));
+	pkc->knum_blocks = rb->pg_vec_len;
+	pkc->kblk_size = req3->tp_block_size;
+	pkc->blk_sizeof_priv = req3->tp_sizeof_priv;
+	pkc->max_frame_len = pkc->kblk_size -
+			     BLK_PLUS_PRIV(pkc->blk_sizeof_priv);
+	pkc->feature_req_word = req3->tp_feature_req_word;
+	pkc->knxt_seq_num = 1;
+	if (req3->tp_retire_blk_tov)
+		pkc->tov_in_jiffies = msecs_to_jiffies(req3->tp_retire_blk_tov);
+	else
+		pkc->tov_in_jiffies = msecs_to_jiffies(DEFAULT_PRB_RETIRE_TOV);
+	if (!pkc->tov_in_jiffies)
+		pkc->tov_in_jiffies = 1;
+	atomic_set(&pkc->blk_fill_in_prog, 0);
+
+	for (i = 0; i < pkc->knum_blocks; i++) {
+		struct tpacket_block_desc *pbd;
+
+		pbd = (struct tpacket_block_desc *)rb->pg_vec[i];
+		pbd->version = TPACKET_V3;
+		pbd->offset_to_priv = BLK_HDR_LEN;
+		pbd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+	}
+	prb_open_block(rb);
+
+	setup_timer(&pkc->retire_blk_timer, prb_retire_rx_blk_timer_expired,
+		    (unsigned long)po);
+	mod_timer(&pkc->retire_blk_timer, jiffies + pkc->tov_in_jiffies);
+}
+
+static void __fanout_unlink(struct sock *sk, struct packet_sock *po);
+static void __fanout_link(struct sock *sk, struct packet_sock *po);
+
+/* register_prot_hook() and unregister_prot_hook() must be called with
+ * po->bind_lock held, or before the socket is visible (packet_create()).
+ */
+static void register_prot_hook(struct sock *sk)
+{
+	struct packet_sock *po = pkt_sk(sk);
+
+	if (!po->running) {
+		if (po->fanout)
+			__fanout_link(sk, po);
+		else
+			dev_add_pack(&po->prot_hook);
+		sock_hold(sk);
+		po->running = 1;
+	}
+}
+
+/* With sync set, bind_lock is dropped while waiting for receivers that
+ * may still see the old hook.
+ */
+static void unregister_prot_hook(struct sock *sk, bool sync)
+{
+	struct packet_sock *po = pkt_sk(sk);
+
+	if (!po->running)
+		return;
+
+	po->running = 0;
+	if (po->fanout)
+		__fanout_unlink(sk, po);
+	else
+		__dev_remove_pack(&po->prot_hook);
+	__sock_put(sk);
+
+	if (sync) {
+		spin_unlock(&po->bind_lock);
+		synchronize_net();
+		spin_lock(&po->bind_lock);
+	}
+}
+
 static void packet_sock_destruct(struct sock *sk)
 {
 	WARN_ON(atomic_read(&sk->sk_rmem_alloc));
@@ -503,7 +835,7 @@ static inline unsigned int run_filter(struct sk_buff *skb, struct sock *sk,
 	rcu_read_lock_bh();
 	filter = rcu_dereference_bh(sk->sk_filter);
 	if (filter != NULL)
-		res = sk_run_filter(skb, filter->insns, filter->len);
+		res = SK_RUN_FILTER(filter, skb);
 	rcu_read_unlock_bh();
 
 	return res;
@@ -640,6 +972,7 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	union {
 		struct tpacket_hdr *h1;
 		struct tpacket2_hdr *h2;
+		struct tpacket3_hdr *h3;
 		void *raw;
 	} h;
 	u8 *skb_head = skb->data;
@@ -691,7 +1024,16 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 		macoff = netoff - maclen;
 	}
 
-	if (macoff + snaplen > po->rx_ring.frame_size) {
+	if (po->tp_version == TPACKET_V3) {
+		/* Frames are variable sized, only clamp to what a block holds */
+		unsigned int max_len = po->rx_ring.prb_bdqc.max_frame_len;
+
+		if (macoff + snaplen > max_len) {
+			snaplen = max_len - macoff;
+			if ((int)snaplen < 0)
+				snaplen = 0;
+		}
+	} else if (macoff + snaplen > po->rx_ring.frame_size) {
 		if (po->copy_thresh &&
 		    atomic_read(&sk->sk_rmem_alloc) + skb->truesize <
 		    (unsigned)sk->sk_rcvbuf) {
@@ -710,10 +1052,17 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	}
 
 	spin_lock(&sk->sk_receive_queue.lock);
-	h.raw = packet_current_frame(po, &po->rx_ring, TP_STATUS_KERNEL);
-	if (!h.raw)
-		goto ring_is_full;
-	packet_increment_head(&po->rx_ring);
+	if (po->tp_version == TPACKET_V3) {
+		h.raw = prb_lookup_frame_in_block(po, macoff + snaplen);
+		if (!h.raw)
+			goto ring_is_full;
+	} else {
+		h.raw = packet_current_frame(po, &po->rx_ring,
+					     TP_STATUS_KERNEL);
+		if (!h.raw)
+			goto ring_is_full;
+		packet_increment_head(&po->rx_ring);
+	}
 	po->stats.tp_packets++;
 	if (copy_skb) {
 		status |= TP_STATUS_COPY;
@@ -753,6 +1102,27 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 		h.h2->tp_vlan_tci = vlan_tx_tag_get(skb);
 		hdrlen = sizeof(*h.h2);
 		break;
+	case TPACKET_V3:
+		/* tp_next_offset is maintained by the block queue */
+		h.h3->tp_status = status;
+		h.h3->tp_len = skb->len;
+		h.h3->tp_snaplen = snaplen;
+		h.h3->tp_mac = macoff;
+		h.h3->tp_net = netoff;
+		if (skb->tstamp.tv64)
+			ts = ktime_to_timespec(skb->tstamp);
+		else
+			getnstimeofday(&ts);
+		h.h3->tp_sec = ts.tv_sec;
+		h.h3->tp_nsec = ts.tv_nsec;
+		h.h3->hv1.tp_vlan_tci = vlan_tx_tag_get(skb);
+		if (po->rx_ring.prb_bdqc.feature_req_word &
+		    TP_FT_REQ_FILL_RXHASH)
+			h.h3->hv1.tp_rxhash = skb_get_rxhash(skb);
+		else
+			h.h3->hv1.tp_rxhash = 0;
+		hdrlen = sizeof(*h.h3);
+		break;
 	default:
 		BUG();
 	}
@@ -768,6 +1138,13 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	else
 		sll->sll_ifindex = dev->ifindex;
 
+	if (po->tp_version == TPACKET_V3) {
+		/* The whole block is flushed and woken up on retirement */
+		smp_wmb();
+		atomic_dec(&po->rx_ring.prb_bdqc.blk_fill_in_prog);
+		goto drop_n_restore;
+	}
+
 	__packet_set_status(po, h.raw, status);
 	smp_mb();
 	{
@@ -797,11 +1174,197 @@ ring_is_full:
 	po->stats.tp_drops++;
 	spin_unlock(&sk->sk_receive_queue.lock);
 
-	sk->sk_data_ready(sk, 0);
+	if (po->tp_version != TPACKET_V3)
+		sk->sk_data_ready(sk, 0);
 	kfree_skb(copy_skb);
 	goto drop_n_restore;
 }
 
+static struct sock *fanout_demux_hash(struct packet_fanout *f,
+				      struct sk_buff *skb, unsigned int num)
+{
+	u32 idx = ((u64)skb_get_rxhash(skb) * num) >> 32;
+
+	return f->arr[idx];
+}
+
+static struct sock *fanout_demux_lb(struct packet_fanout *f,
+				    struct sk_buff *skb, unsigned int num)
+{
+	int cur, old, next;
+
+	cur = atomic_read(&f->rr_cur);
+	for (;;) {
+		next = cur + 1;
+		if (next >= num)
+			next = 0;
+		old = atomic_cmpxchg(&f->rr_cur, cur, next);
+		if (old == cur)
+			break;
+		cur = old;
+	}
+	/* rr_cur may be stale if a member just left */
+	if (cur >= num)
+		cur = 0;
+	return f->arr[cur];
+}
+
+static struct sock *fanout_demux_cpu(struct packet_fanout *f,
+				     struct sk_buff *skb, unsigned int num)
+{
+	return f->arr[smp_processor_id() % num];
+}
+
+static int packet_rcv_fanout(struct sk_buff *skb, struct net_device *dev,
+			     struct packet_type *pt, struct net_device *orig_dev)
+{
+	struct packet_fanout *f = pt->af_packet_priv;
+	unsigned int num = ACCESS_ONCE(f->num_members);
+	struct packet_sock *po;
+	struct sock *sk;
+
+	if (!net_eq(dev_net(dev), read_pnet(&f->net)) || !num) {
+		kfree_skb(skb);
+		return 0;
+	}
+
+	switch (f->type) {
+	case PACKET_FANOUT_HASH:
+	default:
+		sk = fanout_demux_hash(f, skb, num);
+		break;
+	case PACKET_FANOUT_LB:
+		sk = fanout_demux_lb(f, skb, num);
+		break;
+	case PACKET_FANOUT_CPU:
+		sk = fanout_demux_cpu(f, skb, num);
+		break;
+	}
+
+	po = pkt_sk(sk);
+	return po->prot_hook.func(skb, dev, &po->prot_hook, orig_dev);
+}
+
+static DEFINE_MUTEX(fanout_mutex);
+static LIST_HEAD(fanout_list);
+
+static void __fanout_link(struct sock *sk, struct packet_sock *po)
+{
+	struct packet_fanout *f = po->fanout;
+
+	spin_lock(&f->lock);
+	f->arr[f->num_members] = sk;
+	smp_wmb();
+	f->num_members++;
+	spin_unlock(&f->lock);
+}
+
+static void __fanout_unlink(struct sock *sk, struct packet_sock *po)
+{
+	struct packet_fanout *f = po->fanout;
+	int i;
+
+	spin_lock(&f->lock);
+	for (i = 0; i < f->num_members; i++) {
+		if (f->arr[i] == sk)
+			break;
+	}
+	BUG_ON(i >= f->num_members);
+	f->arr[i] = f->arr[f->num_members - 1];
+	f->num_members--;
+	spin_unlock(&f->lock);
+}
+
+static int fanout_add(struct sock *sk, u16 id, u16 type)
+{
+	struct packet_sock *po = pkt_sk(sk);
+	struct packet_fanout *f, *match;
+	int err;
+
+	switch (type) {
+	case PACKET_FANOUT_HASH:
+	case PACKET_FANOUT_LB:
+	case PACKET_FANOUT_CPU:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	mutex_lock(&fanout_mutex);
+	spin_lock(&po->bind_lock);
+	err = -EINVAL;
+	if (!po->running)
+		goto out;
+	err = -EALREADY;
+	if (po->fanout)
+		goto out;
+
+	match = NULL;
+	list_for_each_entry(f, &fanout_list, list) {
+		if (f->id == id &&
+		    read_pnet(&f->net) == sock_net(sk)) {
+			match = f;
+			break;
+		}
+	}
+	if (!match) {
+		err = -ENOMEM;
+		match = kzalloc(sizeof(*match), GFP_ATOMIC);
+		if (!match)
+			goto out;
+		write_pnet(&match->net, sock_net(sk));
+		match->id = id;
+		match->type = type;
+		atomic_set(&match->rr_cur, 0);
+		INIT_LIST_HEAD(&match->list);
+		spin_lock_init(&match->lock);
+		atomic_set(&match->sk_ref, 0);
+		match->prot_hook.type = po->prot_hook.type;
+		match->prot_hook.dev = po->prot_hook.dev;
+		match->prot_hook.func = packet_rcv_fanout;
+		match->prot_hook.af_packet_priv = match;
+		dev_add_pack(&match->prot_hook);
+		list_add(&match->list, &fanout_list);
+	}
+	err = -EINVAL;
+	if (match->type == type &&
+	    match->prot_hook.type == po->prot_hook.type &&
+	    match->prot_hook.dev == po->prot_hook.dev) {
+		err = -ENOSPC;
+		if (atomic_read(&match->sk_ref) < PACKET_FANOUT_MAX) {
+			__dev_remove_pack(&po->prot_hook);
+			po->fanout = match;
+			atomic_inc(&match->sk_ref);
+			__fanout_link(sk, po);
+			err = 0;
+		}
+	}
+out:
+	spin_unlock(&po->bind_lock);
+	mutex_unlock(&fanout_mutex);
+	return err;
+}
+
+static void fanout_release(struct sock *sk)
+{
+	struct packet_sock *po = pkt_sk(sk);
+	struct packet_fanout *f;
+
+	f = po->fanout;
+	if (!f)
+		return;
+
+	po->fanout = NULL;
+
+	mutex_lock(&fanout_mutex);
+	if (atomic_dec_and_test(&f->sk_ref)) {
+		list_del(&f->list);
+		dev_remove_pack(&f->prot_hook);
+		kfree(f);
+	}
+	mutex_unlock(&fanout_mutex);
+}
+
 static void tpacket_destruct_skb(struct sk_buff *skb)
 {
 	struct packet_sock *po = pkt_sk(skb->sk);
@@ -1255,7 +1818,7 @@ static int packet_release(struct socket *sock)
 	struct sock *sk = sock->sk;
 	struct packet_sock *po;
 	struct net *net;
-	struct tpacket_req req;
+	union tpacket_req_u req_u;
 
 	if (!sk)
 		return 0;
@@ -1269,26 +1832,24 @@ static int packet_release(struct socket *sock)
 	spin_unlock_bh(&net->packet.sklist_lock);
 
 	spin_lock(&po->bind_lock);
-	if (po->running) {
-		/*
-		 * Remove from protocol table
-		 */
-		po->running = 0;
-		po->num = 0;
-		__dev_remove_pack(&po->prot_hook);
-		__sock_put(sk);
-	}
+	/*
+	 * Remove from protocol table
+	 */
+	unregister_prot_hook(sk, false);
+	po->num = 0;
 	spin_unlock(&po->bind_lock);
 
+	fanout_release(sk);
+
 	packet_flush_mclist(sk);
 
-	memset(&req, 0, sizeof(req));
+	memset(&req_u, 0, sizeof(req_u));
 
 	if (po->rx_ring.pg_vec)
-		packet_set_ring(sk, &req, 1, 0);
+		packet_set_ring(sk, &req_u, 1, 0);
 
 	if (po->tx_ring.pg_vec)
-		packet_set_ring(sk, &req, 1, 1);
+		packet_set_ring(sk, &req_u, 1, 1);
 
 	synchronize_net();
 	/*
@@ -1313,6 +1874,11 @@ static int packet_release(struct socket *sock)
 static int packet_do_bind(struct sock *sk, struct net_device *dev, __be16 protocol)
 {
 	struct packet_sock *po = pkt_sk(sk);
+
+	/* A fanout member shares its group's hook and cannot move */
+	if (po->fanout)
+		return -EINVAL;
+
 	/*
 	 *	Detach an existing hook if present.
 	 */
@@ -1321,12 +1887,8 @@ static int packet_do_bind(struct sock *sk, struct net_device *dev, __be16 protoc
 
 	spin_lock(&po->bind_lock);
 	if (po->running) {
-		__sock_put(sk);
-		po->running = 0;
 		po->num = 0;
-		spin_unlock(&po->bind_lock);
-		dev_remove_pack(&po->prot_hook);
-		spin_lock(&po->bind_lock);
+		unregister_prot_hook(sk, true);
 	}
 
 	po->num = protocol;
@@ -1339,9 +1901,7 @@ static int packet_do_bind(struct sock *sk, struct net_device *dev, __be16 protoc
 		goto out_unlock;
 
 	if (!dev || (dev->flags & IFF_UP)) {
-		dev_add_pack(&po->prot_hook);
-		sock_hold(sk);
-		po->running = 1;
+		register_prot_hook(sk);
 	} else {
 		sk->sk_err = ENETDOWN;
 		if (!sock_flag(sk, SOCK_DEAD))
@@ -1472,9 +2032,7 @@ static int packet_create(struct net *net, struct socket *sock, int protocol,
 
 	if (proto) {
 		po->prot_hook.type = proto;
-		dev_add_pack(&po->prot_hook);
-		sock_hold(sk);
-		po->running = 1;
+		register_prot_hook(sk);
 	}
 
 	spin_lock_bh(&net->packet.sklist_lock);
@@ -1551,7 +2109,8 @@ static int packet_recvmsg(struct kiocb *iocb, struct socket *sock,
 				vnet_hdr.gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
 			else if (sinfo->gso_type & SKB_GSO_UDP)
 				vnet_hdr.gso_type = VIRTIO_NET_HDR_GSO_UDP;
-			else if (sinfo->gso_type & SKB_GSO_FCOE)
+			else if (sinfo->gso_type & (SKB_GSO_FCOE |
+						      SKB_GSO_UDP_L4))
 				goto out_free;
 			else
 				BUG();
@@ -1861,15 +2420,27 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 	case PACKET_RX_RING:
 	case PACKET_TX_RING:
 	{
-		struct tpacket_req req;
+		union tpacket_req_u req_u;
+		int len;
 
-		if (optlen < sizeof(req))
+		switch (po->tp_version) {
+		case TPACKET_V1:
+		case TPACKET_V2:
+			len = sizeof(req_u.req);
+			break;
+		case TPACKET_V3:
+		default:
+			len = sizeof(req_u.req3);
+			break;
+		}
+		if (optlen < len)
 			return -EINVAL;
 		if (pkt_sk(sk)->has_vnet_hdr)
 			return -EINVAL;
-		if (copy_from_user(&req, optval, sizeof(req)))
+		if (copy_from_user(&req_u, optval, len))
 			return -EFAULT;
-		return packet_set_ring(sk, &req, 0, optname == PACKET_TX_RING);
+		return packet_set_ring(sk, &req_u, 0,
+				       optname == PACKET_TX_RING);
 	}
 	case PACKET_COPY_THRESH:
 	{
@@ -1896,6 +2467,7 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 		switch (val) {
 		case TPACKET_V1:
 		case TPACKET_V2:
+		case TPACKET_V3:
 			po->tp_version = val;
 			return 0;
 		default:
@@ -1968,6 +2540,17 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 		po->has_vnet_hdr = !!val;
 		return 0;
 	}
+	case PACKET_FANOUT:
+	{
+		int val;
+
+		if (optlen != sizeof(val))
+			return -EINVAL;
+		if (copy_from_user(&val, optval, sizeof(val)))
+			return -EFAULT;
+
+		return fanout_add(sk, val & 0xffff, val >> 16);
+	}
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -1981,7 +2564,7 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 	struct sock *sk = sock->sk;
 	struct packet_sock *po = pkt_sk(sk);
 	void *data;
-	struct tpacket_stats st;
+	union tpacket_stats_u st;
 
 	if (level != SOL_PACKET)
 		return -ENOPROTOOPT;
@@ -1994,14 +2577,19 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 
 	switch (optname) {
 	case PACKET_STATISTICS:
-		if (len > sizeof(struct tpacket_stats))
-			len = sizeof(struct tpacket_stats);
 		spin_lock_bh(&sk->sk_receive_queue.lock);
-		st = po->stats;
-		memset(&po->stats, 0, sizeof(st));
+		st.stats3 = po->stats;
+		memset(&po->stats, 0, sizeof(po->stats));
 		spin_unlock_bh(&sk->sk_receive_queue.lock);
-		st.tp_packets += st.tp_drops;
-
+		st.stats3.tp_packets += st.stats3.tp_drops;
+
+		if (po->tp_version == TPACKET_V3) {
+			if (len > sizeof(struct tpacket_stats_v3))
+				len = sizeof(struct tpacket_stats_v3);
+		} else {
+			if (len > sizeof(struct tpacket_stats))
+				len = sizeof(struct tpacket_stats);
+		}
 		data = &st;
 		break;
 	case PACKET_AUXDATA:
@@ -2043,6 +2631,9 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 		case TPACKET_V2:
 			val = sizeof(struct tpacket2_hdr);
 			break;
+		case TPACKET_V3:
+			val = sizeof(struct tpacket3_hdr);
+			break;
 		default:
 			return -EINVAL;
 		}
@@ -2060,6 +2651,15 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 		val = po->tp_loss;
 		data = &val;
 		break;
+	case PACKET_FANOUT:
+		if (len > sizeof(int))
+			len = sizeof(int);
+		val = (po->fanout ?
+		       ((u32)po->fanout->id |
+			((u32)po->fanout->type << 16)) :
+		       0);
+		data = &val;
+		break;
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -2093,9 +2693,7 @@ static int packet_notifier(struct notifier_block *this, unsigned long msg, void
 			if (dev->ifindex == po->ifindex) {
 				spin_lock(&po->bind_lock);
 				if (po->running) {
-					__dev_remove_pack(&po->prot_hook);
-					__sock_put(sk);
-					po->running = 0;
+					unregister_prot_hook(sk, false);
 					sk->sk_err = ENETDOWN;
 					if (!sock_flag(sk, SOCK_DEAD))
 						sk->sk_error_report(sk);
@@ -2110,11 +2708,8 @@ static int packet_notifier(struct notifier_block *this, unsigned long msg, void
 		case NETDEV_UP:
 			if (dev->ifindex == po->ifindex) {
 				spin_lock(&po->bind_lock);
-				if (po->num && !po->running) {
-					dev_add_pack(&po->prot_hook);
-					sock_hold(sk);
-					po->running = 1;
-				}
+				if (po->num)
+					register_prot_hook(sk);
 				spin_unlock(&po->bind_lock);
 			}
 			break;
@@ -2186,7 +2781,15 @@ static unsigned int packet_poll(struct file *file, struct socket *sock,
 	unsigned int mask = datagram_poll(file, sock, wait);
 
 	spin_lock_bh(&sk->sk_receive_queue.lock);
-	if (po->rx_ring.pg_vec) {
+	if (po->rx_ring.pg_vec && po->tp_version == TPACKET_V3) {
+		struct tpacket_kbdq_core *pkc = GET_PBDQC_FROM_RB(&po->rx_ring);
+		unsigned int prev = pkc->kactive_blk_num ?
+				    pkc->kactive_blk_num - 1 :
+				    pkc->knum_blocks - 1;
+
+		if (prb_block_status(&po->rx_ring, prev) != TP_STATUS_KERNEL)
+			mask |= POLLIN | POLLRDNORM;
+	} else if (po->rx_ring.pg_vec) {
 		if (!packet_previous_frame(po, &po->rx_ring, TP_STATUS_KERNEL))
 			mask |= POLLIN | POLLRDNORM;
 	}
@@ -2273,9 +2876,10 @@ out_free_pgvec:
 	goto out;
 }
 
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
+static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		int closing, int tx_ring)
 {
+	struct tpacket_req *req = &req_u->req;
 	char **pg_vec = NULL;
 	struct packet_sock *po = pkt_sk(sk);
 	int was_running, order = 0;
@@ -2308,6 +2912,9 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 		case TPACKET_V2:
 			po->tp_hdrlen = TPACKET2_HDRLEN;
 			break;
+		case TPACKET_V3:
+			po->tp_hdrlen = TPACKET3_HDRLEN;
+			break;
 		}
 
 		err = -EINVAL;
@@ -2328,6 +2935,23 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 					req->tp_frame_nr))
 			goto out;
 
+		if (po->tp_version == TPACKET_V3) {
+			struct tpacket_req3 *req3 = &req_u->req3;
+
+			/* Block queues are receive only */
+			if (unlikely(tx_ring))
+				goto out;
+			if (unlikely(req3->tp_sizeof_priv >= req->tp_block_size))
+				goto out;
+			if (unlikely(po->tp_reserve >= req->tp_block_size))
+				goto out;
+			/* Worst case frame header must fit behind the private area */
+			if (unlikely(BLK_PLUS_PRIV(req3->tp_sizeof_priv) +
+				     TPACKET_ALIGN(po->tp_hdrlen + MAX_HEADER) +
+				     po->tp_reserve > req->tp_block_size))
+				goto out;
+		}
+
 		err = -ENOMEM;
 		order = get_order(req->tp_block_size);
 		pg_vec = alloc_pg_vec(req, order);
@@ -2348,10 +2972,8 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 	was_running = po->running;
 	num = po->num;
 	if (was_running) {
-		__dev_remove_pack(&po->prot_hook);
 		po->num = 0;
-		po->running = 0;
-		__sock_put(sk);
+		unregister_prot_hook(sk, false);
 	}
 	spin_unlock(&po->bind_lock);
 
@@ -2361,6 +2983,8 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 	mutex_lock(&po->pg_vec_lock);
 	if (closing || atomic_read(&po->mapped) == 0) {
 		err = 0;
+		if (!tx_ring && rb->pg_vec && po->tp_version == TPACKET_V3)
+			prb_shutdown_retire_blk_timer(po, rb_queue);
 #define XC(a, b) ({ __typeof__ ((a)) __t; __t = (a); (a) = (b); __t; })
 		spin_lock_bh(&rb_queue->lock);
 		pg_vec = XC(rb->pg_vec, pg_vec);
@@ -2377,6 +3001,8 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 						tpacket_rcv : packet_rcv;
 		skb_queue_purge(rb_queue);
 #undef XC
+		if (!tx_ring && rb->pg_vec && po->tp_version == TPACKET_V3)
+			init_prb_bdqc(po, rb, &req_u->req3);
 		if (atomic_read(&po->mapped))
 			pr_err("packet_mmap: vma is busy: %d\n",
 			       atomic_read(&po->mapped));
@@ -2384,11 +3010,9 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 	mutex_unlock(&po->pg_vec_lock);
 
 	spin_lock(&po->bind_lock);
-	if (was_running && !po->running) {
-		sock_hold(sk);
-		po->running = 1;
+	if (was_running) {
 		po->num = num;
-		dev_add_pack(&po->prot_hook);
+		register_prot_hook(sk);
 	}
 	spin_unlock(&po->bind_lock);
 
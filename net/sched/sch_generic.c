@@ -36,13 +36,67 @@
  * - enqueue, dequeue are serialized via qdisc root lock
  * - ingress filtering is also serialized via qdisc root lock
  * - updates to tree and tree walking are only done under the rtnl mutex.
+ *
+ * Qdiscs flagged TCQ_F_NOLOCK are the exception: they are enqueued to
+ * without the root lock and only dequeued from by the cpu which owns
+ * __QDISC_STATE_RUNNING.
+ */
+
+/* Lockless root pfifo_fast qdiscs, see pfifo_fast_set_lockless() */
+int sysctl_qdisc_lockless __read_mostly;
+
+/* Max packets, and about the bytes, handed to the driver per tx lock */
+#define QDISC_BULK_PACKETS	16
+#define QDISC_BULK_BYTES	65536
+
+/*
+ * The skb requeued into q->gso_skb, or handed to sch_direct_xmit(), may
+ * head a chain of packets linked through ->next, see qdisc_bulk_dequeue().
+ * Only the last packet of a chain can be a GSO skb, as a GSO skb uses
+ * ->next for its segments instead.
  */
+static inline struct sk_buff *qdisc_bulk_next(const struct sk_buff *skb)
+{
+	return skb_is_gso(skb) ? NULL : skb->next;
+}
+
+static inline int qdisc_bulk_len(const struct sk_buff *skb)
+{
+	int len = 1;
+
+	while ((skb = qdisc_bulk_next(skb)) != NULL)
+		len++;
+	return len;
+}
+
+static void qdisc_bulk_free(struct sk_buff *skb)
+{
+	while (skb) {
+		struct sk_buff *next = qdisc_bulk_next(skb);
+
+		if (next)
+			skb->next = NULL;
+		kfree_skb(skb);
+		skb = next;
+	}
+}
+
+/* Whether every packet of q is for the same tx queue */
+static inline bool qdisc_one_txq(struct Qdisc *q)
+{
+	return q->parent != TC_H_ROOT ||
+	       qdisc_dev(q)->real_num_tx_queues == 1;
+}
 
 static inline int dev_requeue_skb(struct sk_buff *skb, struct Qdisc *q)
 {
 	q->gso_skb = skb;
 	q->qstats.requeues++;
-	q->q.qlen++;	/* it's still part of the queue */
+	/* it's still part of the queue */
+	if (q->flags & TCQ_F_NOLOCK)
+		qdisc_qstats_cpu_backlog_inc(q, skb);
+	else
+		q->q.qlen += qdisc_bulk_len(skb);
 	__netif_schedule(q);
 
 	return 0;
@@ -61,7 +115,10 @@ static inline struct sk_buff *dequeue_skb(struct Qdisc *q)
 		if (!netif_tx_queue_stopped(txq) &&
 		    !netif_tx_queue_frozen(txq)) {
 			q->gso_skb = NULL;
-			q->q.qlen--;
+			if (q->flags & TCQ_F_NOLOCK)
+				qdisc_qstats_cpu_backlog_dec(q, skb);
+			else
+				q->q.qlen -= qdisc_bulk_len(skb);
 		} else
 			skb = NULL;
 	} else {
@@ -84,7 +141,7 @@ static inline int handle_dev_cpu_collision(struct sk_buff *skb,
 		 * detect it by checking xmit owner and drop the packet when
 		 * deadloop is detected. Return OK to try the next skb.
 		 */
-		kfree_skb(skb);
+		qdisc_bulk_free(skb);
 		if (net_ratelimit())
 			printk(KERN_WARNING "Dead loop on netdevice %s, "
 			       "fix it urgently!\n", dev_queue->dev->name);
@@ -102,10 +159,56 @@ static inline int handle_dev_cpu_collision(struct sk_buff *skb,
 }
 
 /*
- * Transmit one skb, and handle the return status as required. Holding the
+ * Tell the driver whether the next packet handed to it (under the same tx
+ * lock) will be for the same tx queue, so that it may defer its doorbell.
+ * Packets chained by qdisc_bulk_dequeue() follow for sure.  Past the end
+ * of a chain, only a TCQ_F_NOLOCK qdisc can be dequeued from under the tx
+ * lock, and only one feeding a single tx queue can promise the next
+ * packet's queue.
+ */
+static inline int qdisc_xmit_more(struct Qdisc *q, struct sk_buff *next,
+				  spinlock_t *root_lock, int quota)
+{
+	if (next)
+		return 1;
+	if (root_lock || quota <= 1 || !qdisc_one_txq(q))
+		return 0;
+	return q->ops->peek(q) != NULL;
+}
+
+/*
+ * Hand skb to the driver and track in *owed whether packets sent with
+ * xmit_more may still be waiting for their doorbell.  A GSO skb can be
+ * dropped before any of its segments reaches the driver, so it never
+ * settles what earlier packets promised.
+ */
+static inline int qdisc_hard_start_xmit(struct sk_buff *skb,
+					struct net_device *dev,
+					struct netdev_queue *txq, bool *owed)
+{
+	bool more = skb->xmit_more;
+
+	if (netif_needs_gso(dev, skb))
+		*owed |= more;
+	else
+		*owed = more;
+
+	return dev_hard_start_xmit(skb, dev, txq);
+}
+
+/*
+ * Transmit skb, along with the packets chained to it by qdisc_bulk_dequeue(),
+ * and handle the return status as required. Holding the
  * __QDISC_STATE_RUNNING bit guarantees that only one CPU can execute this
  * function.
  *
+ * A NULL root_lock means q is TCQ_F_NOLOCK: nothing needs to be released
+ * around the driver call, and up to QDISC_BULK_PACKETS further packets for
+ * the same tx queue are dequeued and sent while the tx lock is held.  If
+ * the batch stops short of a packet sent with xmit_more, the driver is
+ * told to flush before the tx lock is dropped.  Whatever part of a chain
+ * was not sent is requeued as a whole.
+ *
  * Returns to the caller:
  *				0  - queue is empty or throttled.
  *				>0 - queue is not empty.
@@ -114,22 +217,60 @@ int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 		    struct net_device *dev, struct netdev_queue *txq,
 		    spinlock_t *root_lock)
 {
-	int ret = NETDEV_TX_BUSY;
+	int ret = NETDEV_TX_OK;
+	int quota = QDISC_BULK_PACKETS;
+	bool owed = false;
 
 	/* And release qdisc */
-	spin_unlock(root_lock);
+	if (root_lock)
+		spin_unlock(root_lock);
 
 	HARD_TX_LOCK(dev, txq, smp_processor_id());
-	if (!netif_tx_queue_stopped(txq) && !netif_tx_queue_frozen(txq))
-		ret = dev_hard_start_xmit(skb, dev, txq);
+	while (skb) {
+		struct sk_buff *next;
+
+		if (netif_tx_queue_stopped(txq) ||
+		    netif_tx_queue_frozen(txq)) {
+			ret = NETDEV_TX_BUSY;
+			break;
+		}
+
+		next = qdisc_bulk_next(skb);
+		if (next)
+			skb->next = NULL;
+		skb->xmit_more = qdisc_xmit_more(q, next, root_lock, quota);
+		ret = qdisc_hard_start_xmit(skb, dev, txq, &owed);
+		if (!dev_xmit_complete(ret)) {
+			if (next)
+				skb->next = next;
+			break;
+		}
+		skb = next;
+
+		if (skb || root_lock || !--quota ||
+		    netif_tx_queue_stopped(txq) || netif_tx_queue_frozen(txq))
+			continue;
+		skb = q->dequeue(q);
+		if (skb && unlikely(netdev_get_tx_queue(dev,
+				skb_get_queue_mapping(skb)) != txq)) {
+			/* Belongs to another tx lock, leave it for later */
+			dev_requeue_skb(skb, q);
+			skb = NULL;
+		}
+	}
+
+	/* The batch ended before the packet it promised reached the driver */
+	if (owed)
+		netdev_xmit_flush(dev, txq);
 
 	HARD_TX_UNLOCK(dev, txq);
 
-	spin_lock(root_lock);
+	if (root_lock)
+		spin_lock(root_lock);
 
-	if (dev_xmit_complete(ret)) {
-		/* Driver sent out skb successfully or skb was consumed */
-		ret = qdisc_qlen(q);
+	if (!skb) {
+		/* Driver sent out all skbs successfully or consumed them */
+		ret = root_lock ? qdisc_qlen(q) : 1;
 	} else if (ret == NETDEV_TX_LOCKED) {
 		/* Driver try lock failed */
 		ret = handle_dev_cpu_collision(skb, txq, q);
@@ -150,7 +291,33 @@ int sch_direct_xmit(struct sk_buff *skb, struct Qdisc *q,
 }
 
 /*
- * NOTE: Called under qdisc_lock(q) with locally disabled BH.
+ * Dequeue more packets behind skb, up to QDISC_BULK_PACKETS and about
+ * QDISC_BULK_BYTES, and chain them to it through ->next so that
+ * sch_direct_xmit() sends them all under one tx lock.  Only done for a
+ * qdisc whose packets all go to one tx queue, under its root lock.  A GSO
+ * skb ends the chain, its ->next is needed for its segments.
+ */
+static inline void qdisc_bulk_dequeue(struct Qdisc *q, struct sk_buff *skb)
+{
+	int packets = 1;
+	int bytes = qdisc_pkt_len(skb);
+
+	while (!skb_is_gso(skb) && packets < QDISC_BULK_PACKETS &&
+	       bytes < QDISC_BULK_BYTES) {
+		struct sk_buff *nskb = q->dequeue(q);
+
+		if (!nskb)
+			break;
+		skb->next = nskb;
+		skb = nskb;
+		packets++;
+		bytes += qdisc_pkt_len(skb);
+	}
+}
+
+/*
+ * NOTE: Called under qdisc_lock(q) with locally disabled BH, or with
+ * just BH disabled for a TCQ_F_NOLOCK qdisc.
  *
  * __QDISC_STATE_RUNNING guarantees only one CPU can process
  * this qdisc at a time. qdisc_lock(q) serializes queue accesses for
@@ -180,7 +347,12 @@ static inline int qdisc_restart(struct Qdisc *q)
 	if (unlikely(!skb))
 		return 0;
 
-	root_lock = qdisc_lock(q);
+	root_lock = NULL;
+	if (!(q->flags & TCQ_F_NOLOCK)) {
+		root_lock = qdisc_lock(q);
+		if (!skb->next && qdisc_one_txq(q))
+			qdisc_bulk_dequeue(q, skb);
+	}
 	dev = qdisc_dev(q);
 	txq = netdev_get_tx_queue(dev, skb_get_queue_mapping(skb));
 
@@ -204,6 +376,17 @@ void __qdisc_run(struct Qdisc *q)
 	}
 
 	clear_bit(__QDISC_STATE_RUNNING, &q->state);
+
+	/*
+	 * A lockless enqueuer may have failed to grab the RUNNING bit just
+	 * before we dropped it; make sure its packet does not get stuck.
+	 * A requeued gso_skb is rescheduled by the driver waking its queue.
+	 */
+	if (q->flags & TCQ_F_NOLOCK) {
+		smp_mb__after_clear_bit();
+		if (!q->gso_skb && q->ops->peek(q))
+			__netif_schedule(q);
+	}
 }
 
 unsigned long dev_trans_start(struct net_device *dev)
@@ -409,8 +592,61 @@ static const u8 prio2band[TC_PRIO_MAX+1] =
 struct pfifo_fast_priv {
 	u32 bitmap;
 	struct sk_buff_head q[PFIFO_FAST_BANDS];
+	struct pfifo_fast_ring *rings;
 };
 
+/*
+ * Lockless mode (TCQ_F_NOLOCK): every band is a ring of skb pointers.
+ * Enqueuers only serialize on the band's producer_lock for the couple of
+ * stores needed to fill a slot, the single consumer (the owner of
+ * __QDISC_STATE_RUNNING) needs no lock at all since a slot is free iff it
+ * holds NULL.
+ */
+struct pfifo_fast_ring {
+	spinlock_t		producer_lock;
+	unsigned int		producer;
+	unsigned int		mask;
+	struct sk_buff		**queue;
+	unsigned int		consumer ____cacheline_aligned_in_smp;
+} ____cacheline_aligned_in_smp;
+
+static int pfifo_fast_ring_produce(struct pfifo_fast_ring *r,
+				   struct sk_buff *skb)
+{
+	int err = -ENOSPC;
+
+	spin_lock(&r->producer_lock);
+	if (!r->queue[r->producer]) {
+		/* skb must be complete before the consumer can see it */
+		smp_wmb();
+		r->queue[r->producer] = skb;
+		r->producer = (r->producer + 1) & r->mask;
+		err = 0;
+	}
+	spin_unlock(&r->producer_lock);
+
+	return err;
+}
+
+static inline struct sk_buff *pfifo_fast_ring_peek(struct pfifo_fast_ring *r)
+{
+	struct sk_buff *skb = ACCESS_ONCE(r->queue[r->consumer]);
+
+	smp_read_barrier_depends();
+	return skb;
+}
+
+static struct sk_buff *pfifo_fast_ring_consume(struct pfifo_fast_ring *r)
+{
+	struct sk_buff *skb = pfifo_fast_ring_peek(r);
+
+	if (skb) {
+		r->queue[r->consumer] = NULL;
+		r->consumer = (r->consumer + 1) & r->mask;
+	}
+	return skb;
+}
+
 /*
  * Convert a bitmap to the first band number where an skb is queued, where:
  * 	bitmap=0 means there are no skbs on any band.
@@ -425,8 +661,27 @@ static inline struct sk_buff_head *band2list(struct pfifo_fast_priv *priv,
 	return priv->q + band;
 }
 
+static int pfifo_fast_enqueue_lockless(struct sk_buff *skb,
+				       struct Qdisc *qdisc)
+{
+	int band = prio2band[skb->priority & TC_PRIO_MAX];
+	struct pfifo_fast_priv *priv = qdisc_priv(qdisc);
+
+	if (unlikely(pfifo_fast_ring_produce(priv->rings + band, skb))) {
+		qdisc_qstats_cpu_drop(qdisc);
+		kfree_skb(skb);
+		return NET_XMIT_DROP;
+	}
+
+	qdisc_qstats_cpu_backlog_inc(qdisc, skb);
+	return NET_XMIT_SUCCESS;
+}
+
 static int pfifo_fast_enqueue(struct sk_buff *skb, struct Qdisc* qdisc)
 {
+	if (qdisc->flags & TCQ_F_NOLOCK)
+		return pfifo_fast_enqueue_lockless(skb, qdisc);
+
 	if (skb_queue_len(&qdisc->q) < qdisc_dev(qdisc)->tx_queue_len) {
 		int band = prio2band[skb->priority & TC_PRIO_MAX];
 		struct pfifo_fast_priv *priv = qdisc_priv(qdisc);
@@ -440,11 +695,32 @@ static int pfifo_fast_enqueue(struct sk_buff *skb, struct Qdisc* qdisc)
 	return qdisc_drop(skb, qdisc);
 }
 
+static struct sk_buff *pfifo_fast_dequeue_lockless(struct Qdisc *qdisc)
+{
+	struct pfifo_fast_priv *priv = qdisc_priv(qdisc);
+	struct sk_buff *skb;
+	int band;
+
+	for (band = 0; band < PFIFO_FAST_BANDS; band++) {
+		skb = pfifo_fast_ring_consume(priv->rings + band);
+		if (skb) {
+			qdisc_qstats_cpu_backlog_dec(qdisc, skb);
+			__qdisc_update_bstats(qdisc, qdisc_pkt_len(skb));
+			return skb;
+		}
+	}
+
+	return NULL;
+}
+
 static struct sk_buff *pfifo_fast_dequeue(struct Qdisc* qdisc)
 {
 	struct pfifo_fast_priv *priv = qdisc_priv(qdisc);
 	int band = bitmap2band[priv->bitmap];
 
+	if (qdisc->flags & TCQ_F_NOLOCK)
+		return pfifo_fast_dequeue_lockless(qdisc);
+
 	if (likely(band >= 0)) {
 		struct sk_buff_head *list = band2list(priv, band);
 		struct sk_buff *skb = __qdisc_dequeue_head(qdisc, list);
@@ -464,6 +740,14 @@ static struct sk_buff *pfifo_fast_peek(struct Qdisc* qdisc)
 	struct pfifo_fast_priv *priv = qdisc_priv(qdisc);
 	int band = bitmap2band[priv->bitmap];
 
+	if (qdisc->flags & TCQ_F_NOLOCK) {
+		struct sk_buff *skb = NULL;
+
+		for (band = 0; band < PFIFO_FAST_BANDS && !skb; band++)
+			skb = pfifo_fast_ring_peek(priv->rings + band);
+		return skb;
+	}
+
 	if (band >= 0) {
 		struct sk_buff_head *list = band2list(priv, band);
 
@@ -473,11 +757,32 @@ static struct sk_buff *pfifo_fast_peek(struct Qdisc* qdisc)
 	return NULL;
 }
 
+/*
+ * Enqueuers may still be running on other cpus, so their per cpu
+ * counters are left alone: every skb thrown away is accounted for on
+ * this cpu instead, just like a dequeue, and the sums stay exact.
+ */
+static void pfifo_fast_reset_lockless(struct Qdisc *qdisc)
+{
+	struct pfifo_fast_priv *priv = qdisc_priv(qdisc);
+	struct sk_buff *skb;
+	int band;
+
+	for (band = 0; band < PFIFO_FAST_BANDS; band++)
+		while ((skb = pfifo_fast_ring_consume(priv->rings + band))) {
+			qdisc_qstats_cpu_backlog_dec(qdisc, skb);
+			kfree_skb(skb);
+		}
+}
+
 static void pfifo_fast_reset(struct Qdisc* qdisc)
 {
 	int prio;
 	struct pfifo_fast_priv *priv = qdisc_priv(qdisc);
 
+	if (qdisc->flags & TCQ_F_NOLOCK)
+		pfifo_fast_reset_lockless(qdisc);
+
 	for (prio = 0; prio < PFIFO_FAST_BANDS; prio++)
 		__qdisc_reset_queue(qdisc, band2list(priv, prio));
 
@@ -509,6 +814,66 @@ static int pfifo_fast_init(struct Qdisc *qdisc, struct nlattr *opt)
 	return 0;
 }
 
+static void pfifo_fast_destroy(struct Qdisc *qdisc)
+{
+	struct pfifo_fast_priv *priv = qdisc_priv(qdisc);
+	int band;
+
+	if (!priv->rings)
+		return;
+
+	for (band = 0; band < PFIFO_FAST_BANDS; band++)
+		kfree(priv->rings[band].queue);
+	kfree(priv->rings);
+	free_percpu(qdisc->cpu_qstats);
+}
+
+/*
+ * Switch an idle, empty pfifo_fast which is about to become the root of a
+ * device queue into lockless mode, if the administrator asked for it.  The
+ * bands are sized like the locked queue limit; on allocation failure the
+ * qdisc simply stays locked.
+ */
+static void pfifo_fast_set_lockless(struct Qdisc *qdisc)
+{
+	struct pfifo_fast_priv *priv = qdisc_priv(qdisc);
+	unsigned int size;
+	int band;
+
+	if (!sysctl_qdisc_lockless || qdisc->ops != &pfifo_fast_ops ||
+	    qdisc->flags & TCQ_F_NOLOCK || qdisc->q.qlen)
+		return;
+
+	size = roundup_pow_of_two(max_t(unsigned long,
+					qdisc_dev(qdisc)->tx_queue_len, 1));
+
+	priv->rings = kcalloc(PFIFO_FAST_BANDS, sizeof(*priv->rings),
+			      GFP_KERNEL);
+	if (!priv->rings)
+		return;
+	qdisc->cpu_qstats = alloc_percpu(struct gnet_stats_queue);
+	if (!qdisc->cpu_qstats)
+		goto err;
+
+	for (band = 0; band < PFIFO_FAST_BANDS; band++) {
+		struct pfifo_fast_ring *r = priv->rings + band;
+
+		spin_lock_init(&r->producer_lock);
+		r->mask = size - 1;
+		r->queue = kcalloc(size, sizeof(*r->queue), GFP_KERNEL);
+		if (!r->queue)
+			goto err;
+	}
+
+	qdisc->flags |= TCQ_F_NOLOCK;
+	return;
+
+err:
+	pfifo_fast_destroy(qdisc);
+	priv->rings = NULL;
+	qdisc->cpu_qstats = NULL;
+}
+
 struct Qdisc_ops pfifo_fast_ops __read_mostly = {
 	.id		=	"pfifo_fast",
 	.priv_size	=	sizeof(struct pfifo_fast_priv),
@@ -517,6 +882,7 @@ struct Qdisc_ops pfifo_fast_ops __read_mostly = {
 	.peek		=	pfifo_fast_peek,
 	.init		=	pfifo_fast_init,
 	.reset		=	pfifo_fast_reset,
+	.destroy	=	pfifo_fast_destroy,
 	.dump		=	pfifo_fast_dump,
 	.owner		=	THIS_MODULE,
 };
@@ -580,14 +946,27 @@ void qdisc_reset(struct Qdisc *qdisc)
 {
 	const struct Qdisc_ops *ops = qdisc->ops;
 
+	/*
+	 * The root lock does not keep the dequeuer of a lockless qdisc
+	 * away; if it is running, it will be reset again once idle.
+	 */
+	if (qdisc->flags & TCQ_F_NOLOCK &&
+	    test_and_set_bit(__QDISC_STATE_RUNNING, &qdisc->state))
+		return;
+
 	if (ops->reset)
 		ops->reset(qdisc);
 
 	if (qdisc->gso_skb) {
-		kfree_skb(qdisc->gso_skb);
+		if (qdisc->flags & TCQ_F_NOLOCK)
+			qdisc_qstats_cpu_backlog_dec(qdisc, qdisc->gso_skb);
+		qdisc_bulk_free(qdisc->gso_skb);
 		qdisc->gso_skb = NULL;
 		qdisc->q.qlen = 0;
 	}
+
+	if (qdisc->flags & TCQ_F_NOLOCK)
+		clear_bit(__QDISC_STATE_RUNNING, &qdisc->state);
 }
 EXPORT_SYMBOL(qdisc_reset);
 
@@ -613,7 +992,7 @@ void qdisc_destroy(struct Qdisc *qdisc)
 	module_put(ops->owner);
 	dev_put(qdisc_dev(qdisc));
 
-	kfree_skb(qdisc->gso_skb);
+	qdisc_bulk_free(qdisc->gso_skb);
 	kfree((char *) qdisc - qdisc->padded);
 }
 EXPORT_SYMBOL(qdisc_destroy);
@@ -625,6 +1004,9 @@ struct Qdisc *dev_graft_qdisc(struct netdev_queue *dev_queue,
 	struct Qdisc *oqdisc = dev_queue->qdisc_sleeping;
 	spinlock_t *root_lock;
 
+	if (qdisc)
+		pfifo_fast_set_lockless(qdisc);
+
 	root_lock = qdisc_lock(oqdisc);
 	spin_lock_bh(root_lock);
 
@@ -659,6 +1041,7 @@ static void attach_one_default_qdisc(struct net_device *dev,
 
 		/* Can by-pass the queue discipline for default qdisc */
 		qdisc->flags |= TCQ_F_CAN_BYPASS;
+		pfifo_fast_set_lockless(qdisc);
 	} else {
 		qdisc =  &noqueue_qdisc;
 	}
@@ -750,6 +1133,19 @@ static void dev_deactivate_queue(struct net_device *dev,
 	}
 }
 
+static void dev_reset_lockless_queue(struct net_device *dev,
+				     struct netdev_queue *dev_queue,
+				     void *_unused)
+{
+	struct Qdisc *qdisc = dev_queue->qdisc_sleeping;
+
+	if (qdisc->flags & TCQ_F_NOLOCK) {
+		spin_lock_bh(qdisc_lock(qdisc));
+		qdisc_reset(qdisc);
+		spin_unlock_bh(qdisc_lock(qdisc));
+	}
+}
+
 static bool some_qdisc_is_busy(struct net_device *dev)
 {
 	unsigned int i;
@@ -790,6 +1186,9 @@ void dev_deactivate(struct net_device *dev)
 	/* Wait for outstanding qdisc_run calls. */
 	while (some_qdisc_is_busy(dev))
 		yield();
+
+	/* Lockless qdiscs could not be reset while they were running. */
+	netdev_for_each_tx_queue(dev, dev_reset_lockless_queue, NULL);
 }
 
 static void dev_init_scheduler_queue(struct net_device *dev,
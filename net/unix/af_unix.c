@@ -114,12 +114,22 @@
 #include <linux/mount.h>
 #include <net/checksum.h>
 #include <linux/security.h>
+#include <linux/hash.h>
 
-static struct hlist_head unix_socket_table[UNIX_HASH_SIZE + 1];
-static DEFINE_SPINLOCK(unix_table_lock);
+/*
+ * Bound sockets are hashed into the first UNIX_HASH_SIZE chains, by name
+ * for abstract and by inode for filesystem sockets.  Unbound sockets are
+ * spread over the other half by their address.  Each chain has its own
+ * lock, sk->sk_hash tells which chain a socket is on.
+ */
+static struct hlist_head unix_socket_table[2 * UNIX_HASH_SIZE];
+static spinlock_t unix_table_locks[2 * UNIX_HASH_SIZE];
 static atomic_t unix_nr_socks = ATOMIC_INIT(0);
 
-#define unix_sockets_unbound	(&unix_socket_table[UNIX_HASH_SIZE])
+static inline unsigned unix_unbound_hash(struct sock *sk)
+{
+	return UNIX_HASH_SIZE + hash_ptr(sk, UNIX_HASH_BITS);
+}
 
 #define UNIX_ABSTRACT(sk)	(unix_sk(sk)->addr->hash != UNIX_HASH_SIZE)
 
@@ -143,7 +153,9 @@ static inline void unix_set_secdata(struct scm_cookie *scm, struct sk_buff *skb)
 
 /*
  *  SMP locking strategy:
- *    hash table is protected with spinlock unix_table_lock
+ *    each hash chain is protected with its own spinlock in unix_table_locks;
+ *    when moving a socket from an unbound to a bound chain both are held,
+ *    the bound one first
  *    each socket state is protected by separate spin lock.
  */
 
@@ -225,24 +237,48 @@ static void __unix_remove_socket(struct sock *sk)
 	sk_del_node_init(sk);
 }
 
-static void __unix_insert_socket(struct hlist_head *list, struct sock *sk)
+static void __unix_insert_socket(struct sock *sk)
 {
 	WARN_ON(!sk_unhashed(sk));
-	sk_add_node(sk, list);
+	sk_add_node(sk, &unix_socket_table[sk->sk_hash]);
+}
+
+/* Move an unbound socket to the chain of its new address. */
+static void __unix_set_addr(struct sock *sk, struct unix_address *addr,
+			    unsigned hash)
+{
+	__unix_remove_socket(sk);
+	unix_sk(sk)->addr = addr;
+	sk->sk_hash = hash;
+	__unix_insert_socket(sk);
 }
 
 static inline void unix_remove_socket(struct sock *sk)
 {
-	spin_lock(&unix_table_lock);
+	spin_lock(&unix_table_locks[sk->sk_hash]);
 	__unix_remove_socket(sk);
-	spin_unlock(&unix_table_lock);
+	spin_unlock(&unix_table_locks[sk->sk_hash]);
 }
 
-static inline void unix_insert_socket(struct hlist_head *list, struct sock *sk)
+static inline void unix_insert_unbound_socket(struct sock *sk)
 {
-	spin_lock(&unix_table_lock);
-	__unix_insert_socket(list, sk);
-	spin_unlock(&unix_table_lock);
+	sk->sk_hash = unix_unbound_hash(sk);
+	spin_lock(&unix_table_locks[sk->sk_hash]);
+	__unix_insert_socket(sk);
+	spin_unlock(&unix_table_locks[sk->sk_hash]);
+}
+
+/* hash1 is a bound chain, hash2 the unbound chain of the same socket. */
+static void unix_table_double_lock(unsigned hash1, unsigned hash2)
+{
+	spin_lock(&unix_table_locks[hash1]);
+	spin_lock_nested(&unix_table_locks[hash2], SINGLE_DEPTH_NESTING);
+}
+
+static void unix_table_double_unlock(unsigned hash1, unsigned hash2)
+{
+	spin_unlock(&unix_table_locks[hash2]);
+	spin_unlock(&unix_table_locks[hash1]);
 }
 
 static struct sock *__unix_find_socket_byname(struct net *net,
@@ -274,22 +310,22 @@ static inline struct sock *unix_find_socket_byname(struct net *net,
 {
 	struct sock *s;
 
-	spin_lock(&unix_table_lock);
+	spin_lock(&unix_table_locks[hash ^ type]);
 	s = __unix_find_socket_byname(net, sunname, len, type, hash);
 	if (s)
 		sock_hold(s);
-	spin_unlock(&unix_table_lock);
+	spin_unlock(&unix_table_locks[hash ^ type]);
 	return s;
 }
 
 static struct sock *unix_find_socket_byinode(struct net *net, struct inode *i)
 {
+	unsigned hash = i->i_ino & (UNIX_HASH_SIZE - 1);
 	struct sock *s;
 	struct hlist_node *node;
 
-	spin_lock(&unix_table_lock);
-	sk_for_each(s, node,
-		    &unix_socket_table[i->i_ino & (UNIX_HASH_SIZE - 1)]) {
+	spin_lock(&unix_table_locks[hash]);
+	sk_for_each(s, node, &unix_socket_table[hash]) {
 		struct dentry *dentry = unix_sk(s)->dentry;
 
 		if (!net_eq(sock_net(s), net))
@@ -302,7 +338,7 @@ static struct sock *unix_find_socket_byinode(struct net *net, struct inode *i)
 	}
 	s = NULL;
 found:
-	spin_unlock(&unix_table_lock);
+	spin_unlock(&unix_table_locks[hash]);
 	return s;
 }
 
@@ -444,7 +480,7 @@ static int unix_release_sock(struct sock *sk, int embrion)
 	 */
 
 	if (unix_tot_inflight)
-		unix_gc();		/* Garbage collect fds */
+		unix_gc();		/* Schedule a garbage collection of fds */
 
 	return 0;
 }
@@ -609,7 +645,7 @@ static struct sock *unix_create1(struct net *net, struct socket *sock)
 	INIT_LIST_HEAD(&u->link);
 	mutex_init(&u->readlock); /* single task reading lock */
 	init_waitqueue_head(&u->peer_wait);
-	unix_insert_socket(unix_sockets_unbound, sk);
+	unix_insert_unbound_socket(sk);
 out:
 	if (sk == NULL)
 		atomic_dec(&unix_nr_socks);
@@ -669,8 +705,9 @@ static int unix_autobind(struct socket *sock)
 	struct sock *sk = sock->sk;
 	struct net *net = sock_net(sk);
 	struct unix_sock *u = unix_sk(sk);
-	static u32 ordernum = 1;
+	u32 lastnum, ordernum;
 	struct unix_address *addr;
+	unsigned new_hash, old_hash = sk->sk_hash;
 	int err;
 
 	mutex_lock(&u->readlock);
@@ -687,27 +724,37 @@ static int unix_autobind(struct socket *sock)
 	addr->name->sun_family = AF_UNIX;
 	atomic_set(&addr->refcnt, 1);
 
+	/* Start at a random name so that concurrent autobinds do not all
+	 * probe the same chain.
+	 */
+	ordernum = random32() & 0xFFFFF;
+	lastnum = ordernum;
 retry:
 	addr->len = sprintf(addr->name->sun_path+1, "%05x", ordernum) + 1 + sizeof(short);
 	addr->hash = unix_hash_fold(csum_partial(addr->name, addr->len, 0));
+	new_hash = addr->hash ^ sk->sk_type;
 
-	spin_lock(&unix_table_lock);
-	ordernum = (ordernum+1)&0xFFFFF;
+	unix_table_double_lock(new_hash, old_hash);
 
 	if (__unix_find_socket_byname(net, addr->name, addr->len, sock->type,
 				      addr->hash)) {
-		spin_unlock(&unix_table_lock);
+		unix_table_double_unlock(new_hash, old_hash);
+		ordernum = (ordernum+1)&0xFFFFF;
+		if (ordernum == lastnum) {
+			/* The whole name space is taken */
+			err = -ENOSPC;
+			kfree(addr);
+			goto out;
+		}
 		/* Sanity yield. It is unusual case, but yet... */
 		if (!(ordernum&0xFF))
 			yield();
 		goto retry;
 	}
-	addr->hash ^= sk->sk_type;
+	addr->hash = new_hash;
 
-	__unix_remove_socket(sk);
-	u->addr = addr;
-	__unix_insert_socket(&unix_socket_table[addr->hash], sk);
-	spin_unlock(&unix_table_lock);
+	__unix_set_addr(sk, addr, new_hash);
+	unix_table_double_unlock(new_hash, old_hash);
 	err = 0;
 
 out:	mutex_unlock(&u->readlock);
@@ -779,9 +826,8 @@ static int unix_bind(struct socket *sock, struct sockaddr *uaddr, int addr_len)
 	struct dentry *dentry = NULL;
 	struct nameidata nd;
 	int err;
-	unsigned hash;
+	unsigned hash, new_hash, old_hash = sk->sk_hash;
 	struct unix_address *addr;
-	struct hlist_head *list;
 
 	err = -EINVAL;
 	if (sunaddr->sun_family != AF_UNIX)
@@ -852,7 +898,12 @@ out_mknod_drop_write:
 		addr->hash = UNIX_HASH_SIZE;
 	}
 
-	spin_lock(&unix_table_lock);
+	if (!sunaddr->sun_path[0])
+		new_hash = addr->hash;
+	else
+		new_hash = dentry->d_inode->i_ino & (UNIX_HASH_SIZE-1);
+
+	unix_table_double_lock(new_hash, old_hash);
 
 	if (!sunaddr->sun_path[0]) {
 		err = -EADDRINUSE;
@@ -861,21 +912,16 @@ out_mknod_drop_write:
 			unix_release_addr(addr);
 			goto out_unlock;
 		}
-
-		list = &unix_socket_table[addr->hash];
 	} else {
-		list = &unix_socket_table[dentry->d_inode->i_ino & (UNIX_HASH_SIZE-1)];
 		u->dentry = nd.path.dentry;
 		u->mnt    = nd.path.mnt;
 	}
 
 	err = 0;
-	__unix_remove_socket(sk);
-	u->addr = addr;
-	__unix_insert_socket(list, sk);
+	__unix_set_addr(sk, addr, new_hash);
 
 out_unlock:
-	spin_unlock(&unix_table_lock);
+	unix_table_double_unlock(new_hash, old_hash);
 out_up:
 	mutex_unlock(&u->readlock);
 out:
@@ -2078,76 +2124,99 @@ static unsigned int unix_dgram_poll(struct file *file, struct socket *sock,
 }
 
 #ifdef CONFIG_PROC_FS
-static struct sock *first_unix_socket(int *i)
+
+/*
+ * The seq_file position is the chain in the upper bits and the offset
+ * into the chain below, so that the walk can drop the chain lock between
+ * reads.
+ */
+#define UNIX_BUCKET_SPACE	(BITS_PER_LONG - (UNIX_HASH_BITS + 1) - 1)
+
+#define get_bucket(x) ((x) >> UNIX_BUCKET_SPACE)
+#define get_offset(x) ((x) & ((1L << UNIX_BUCKET_SPACE) - 1))
+#define set_bucket_offset(b, o) ((b) << UNIX_BUCKET_SPACE | (o))
+
+static struct sock *unix_from_bucket(struct seq_file *seq, loff_t *pos)
 {
-	for (*i = 0; *i <= UNIX_HASH_SIZE; (*i)++) {
-		if (!hlist_empty(&unix_socket_table[*i]))
-			return __sk_head(&unix_socket_table[*i]);
+	unsigned long offset = get_offset(*pos);
+	unsigned long bucket = get_bucket(*pos);
+	struct sock *sk;
+	unsigned long count = 0;
+
+	for (sk = sk_head(&unix_socket_table[bucket]); sk; sk = sk_next(sk)) {
+		if (sock_net(sk) != seq_file_net(seq))
+			continue;
+		if (++count == offset)
+			break;
 	}
-	return NULL;
+
+	return sk;
 }
 
-static struct sock *next_unix_socket(int *i, struct sock *s)
+/* Returns with the lock of the socket's chain held. */
+static struct sock *unix_get_first(struct seq_file *seq, loff_t *pos)
 {
-	struct sock *next = sk_next(s);
-	/* More in this chain? */
-	if (next)
-		return next;
-	/* Look for next non-empty chain. */
-	for ((*i)++; *i <= UNIX_HASH_SIZE; (*i)++) {
-		if (!hlist_empty(&unix_socket_table[*i]))
-			return __sk_head(&unix_socket_table[*i]);
+	unsigned long bucket = get_bucket(*pos);
+	struct sock *sk;
+
+	while (bucket < 2 * UNIX_HASH_SIZE) {
+		spin_lock(&unix_table_locks[bucket]);
+
+		sk = unix_from_bucket(seq, pos);
+		if (sk)
+			return sk;
+
+		spin_unlock(&unix_table_locks[bucket]);
+
+		*pos = set_bucket_offset(++bucket, 1);
 	}
+
 	return NULL;
 }
 
-struct unix_iter_state {
-	struct seq_net_private p;
-	int i;
-};
-
-static struct sock *unix_seq_idx(struct seq_file *seq, loff_t pos)
+static struct sock *unix_get_next(struct seq_file *seq, struct sock *sk,
+				  loff_t *pos)
 {
-	struct unix_iter_state *iter = seq->private;
-	loff_t off = 0;
-	struct sock *s;
+	unsigned long bucket = get_bucket(*pos);
 
-	for (s = first_unix_socket(&iter->i); s; s = next_unix_socket(&iter->i, s)) {
-		if (sock_net(s) != seq_file_net(seq))
-			continue;
-		if (off == pos)
-			return s;
-		++off;
-	}
-	return NULL;
+	for (sk = sk_next(sk); sk; sk = sk_next(sk))
+		if (sock_net(sk) == seq_file_net(seq))
+			return sk;
+
+	spin_unlock(&unix_table_locks[bucket]);
+
+	*pos = set_bucket_offset(++bucket, 1);
+
+	return unix_get_first(seq, pos);
 }
 
 static void *unix_seq_start(struct seq_file *seq, loff_t *pos)
-	__acquires(unix_table_lock)
 {
-	spin_lock(&unix_table_lock);
-	return *pos ? unix_seq_idx(seq, *pos - 1) : SEQ_START_TOKEN;
+	if (!*pos)
+		return SEQ_START_TOKEN;
+
+	if (get_bucket(*pos) >= 2 * UNIX_HASH_SIZE)
+		return NULL;
+
+	return unix_get_first(seq, pos);
 }
 
 static void *unix_seq_next(struct seq_file *seq, void *v, loff_t *pos)
 {
-	struct unix_iter_state *iter = seq->private;
-	struct sock *sk = v;
 	++*pos;
 
 	if (v == SEQ_START_TOKEN)
-		sk = first_unix_socket(&iter->i);
-	else
-		sk = next_unix_socket(&iter->i, sk);
-	while (sk && (sock_net(sk) != seq_file_net(seq)))
-		sk = next_unix_socket(&iter->i, sk);
-	return sk;
+		return unix_get_first(seq, pos);
+
+	return unix_get_next(seq, v, pos);
 }
 
 static void unix_seq_stop(struct seq_file *seq, void *v)
-	__releases(unix_table_lock)
 {
-	spin_unlock(&unix_table_lock);
+	struct sock *sk = v;
+
+	if (sk && v != SEQ_START_TOKEN)
+		spin_unlock(&unix_table_locks[sk->sk_hash]);
 }
 
 static int unix_seq_show(struct seq_file *seq, void *v)
@@ -2204,7 +2273,7 @@ static const struct seq_operations unix_seq_ops = {
 static int unix_seq_open(struct inode *inode, struct file *file)
 {
 	return seq_open_net(inode, file, &unix_seq_ops,
-			    sizeof(struct unix_iter_state));
+			    sizeof(struct seq_net_private));
 }
 
 static const struct file_operations unix_seq_fops = {
@@ -2256,11 +2325,14 @@ static struct pernet_operations unix_net_ops = {
 
 static int __init af_unix_init(void)
 {
-	int rc = -1;
+	int i, rc = -1;
 	struct sk_buff *dummy_skb;
 
 	BUILD_BUG_ON(sizeof(struct unix_skb_parms) > sizeof(dummy_skb->cb));
 
+	for (i = 0; i < 2 * UNIX_HASH_SIZE; i++)
+		spin_lock_init(&unix_table_locks[i]);
+
 	rc = proto_register(&unix_proto, 1);
 	if (rc != 0) {
 		printk(KERN_CRIT "%s: Cannot create unix_sock SLAB cache!\n",
@@ -2277,6 +2349,7 @@ out:
 static void __exit af_unix_exit(void)
 {
 	sock_unregister(PF_UNIX);
+	unix_gc_flush();
 	proto_unregister(&unix_proto);
 	unregister_pernet_subsys(&unix_net_ops);
 }
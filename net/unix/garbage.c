@@ -80,6 +80,7 @@
 #include <linux/proc_fs.h>
 #include <linux/mutex.h>
 #include <linux/wait.h>
+#include <linux/workqueue.h>
 
 #include <net/sock.h>
 #include <net/af_unix.h>
@@ -269,13 +270,49 @@ static void inc_inflight_move_tail(struct unix_sock *u)
 
 static bool gc_in_progress = false;
 
+static void unix_gc_work_fn(struct work_struct *work);
+static DECLARE_WORK(unix_gc_work, unix_gc_work_fn);
+
+/*
+ * Number of descriptors in flight above which senders of more of them
+ * have to wait for a garbage collection to finish.
+ */
+#define UNIX_INFLIGHT_TRIGGER_GC 16000
+
 void wait_for_unix_gc(void)
 {
-	wait_event(unix_gc_wait, gc_in_progress == false);
+	/*
+	 * Senders only stall when descriptors pile up faster than they
+	 * are collected, otherwise the collection runs in the background.
+	 */
+	if (unix_tot_inflight > UNIX_INFLIGHT_TRIGGER_GC) {
+		unix_gc();
+		wait_event(unix_gc_wait, gc_in_progress == false);
+	}
 }
 
-/* The external entry point: unix_gc() */
+/*
+ * The external entry point: unix_gc() schedules a collection unless one
+ * is already pending or running, so that closing sockets never does the
+ * work itself and bursts of closes cost a single pass.
+ */
 void unix_gc(void)
+{
+	spin_lock(&unix_gc_lock);
+	if (!gc_in_progress) {
+		gc_in_progress = true;
+		schedule_work(&unix_gc_work);
+	}
+	spin_unlock(&unix_gc_lock);
+}
+
+/* Wait for a scheduled collection before the module goes away. */
+void unix_gc_flush(void)
+{
+	flush_work(&unix_gc_work);
+}
+
+static void unix_gc_work_fn(struct work_struct *work)
 {
 	struct unix_sock *u;
 	struct unix_sock *next;
@@ -285,11 +322,6 @@ void unix_gc(void)
 
 	spin_lock(&unix_gc_lock);
 
-	/* Avoid a recursive GC. */
-	if (gc_in_progress)
-		goto out;
-
-	gc_in_progress = true;
 	/*
 	 * First, select candidates for garbage collection.  Only
 	 * in-flight sockets are considered, and from those only ones
@@ -383,6 +415,5 @@ void unix_gc(void)
 	gc_in_progress = false;
 	wake_up(&unix_gc_wait);
 
- out:
 	spin_unlock(&unix_gc_lock);
 }
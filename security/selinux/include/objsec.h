@@ -115,6 +115,10 @@ struct key_security_struct {
 	u32 sid;	/* SID of key */
 };
 
+struct tun_security_struct {
+	u32 sid;	/* SID for the tun device sockets */
+};
+
 extern unsigned int selinux_checkreqprot;
 
 #endif /* _SELINUX_OBJSEC_H_ */